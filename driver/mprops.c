@@ -19,582 +19,374 @@
  *
  **************************************************************************/
 
+
 #include "mprops.h"
 #include "common.h"
 #include "mtouch.h"
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
 
 #define MAX_INT_VALUES 4
 #define MAX_FLOAT_VALUES 4
 
-#define VALID_BUTTON(x) (x >= 0 && x <= 32)
-#define VALID_BOOL(x) (x == 0 || x == 1)
-#define VALID_PCNT(x) (x >= 0 && x <= 100)
+/* One value of a property: where it lives in MConfig and the range it
+ * must be in.
+ */
+struct MPropValue {
+	size_t offset;
+	int min, max;
+};
+
+/* A property: format 8, 16 or 32 for integers or 0 for a float, and
+ * its values, all of the same type.
+ */
+struct MPropDesc {
+	const char *name;
+	int format;
+	int count;
+	struct MPropValue value[MAX_INT_VALUES];
+};
+
+#define VALUE(f, min, max) { offsetof(struct MConfig, f), min, max }
+#define VALUE_MIN(f, min) VALUE(f, min, INT_MAX)
+#define VALUE_BOOL(f) VALUE(f, 0, 1)
+#define VALUE_PCNT(f) VALUE(f, 0, 100)
+#define VALUE_BUTTON(f) VALUE(f, 0, 32)
+
+#ifdef HAVE_TOUCH_EVENTS
+#define MAX_PASSTHROUGH 1
+#else
+#define MAX_PASSTHROUGH 0
+#endif
+
+static const struct MPropDesc props[] = {
+	{ MTRACK_PROP_TRACKPAD_DISABLE, 8, 1, {
+		VALUE(trackpad_disable, 0, 3) } },
+	{ MTRACK_PROP_PASSTHROUGH, 8, 1, {
+		VALUE(passthrough, 0, MAX_PASSTHROUGH) } },
+	{ MTRACK_PROP_SENSITIVITY, 0, 1, {
+		VALUE_MIN(sensitivity, 0) } },
+	{ MTRACK_PROP_PRESSURE, 8, 2, {
+		VALUE_PCNT(touch_down), VALUE_PCNT(touch_up) } },
+	{ MTRACK_PROP_BUTTON_SETTINGS, 16, 4, {
+		VALUE_BOOL(button_enable), VALUE_BOOL(button_integrated),
+		VALUE_MIN(button_expire, 0), VALUE_BOOL(button_zones) } },
+	{ MTRACK_PROP_BUTTON_EMULATE, 8, 3, {
+		VALUE_BUTTON(button_1touch), VALUE_BUTTON(button_2touch),
+		VALUE_BUTTON(button_3touch) } },
+	{ MTRACK_PROP_TAP_SETTINGS, 32, 3, {
+		VALUE_MIN(tap_hold, 1), VALUE_MIN(tap_timeout, 1),
+		VALUE_MIN(tap_dist, 1) } },
+	{ MTRACK_PROP_TAP_EMULATE, 8, 4, {
+		VALUE_BUTTON(tap_1touch), VALUE_BUTTON(tap_2touch),
+		VALUE_BUTTON(tap_3touch), VALUE_BUTTON(tap_4touch) } },
+	{ MTRACK_PROP_THUMB_DETECT, 8, 2, {
+		VALUE_BOOL(ignore_thumb), VALUE_BOOL(disable_on_thumb) } },
+	{ MTRACK_PROP_THUMB_SIZE, 32, 2, {
+		VALUE_MIN(thumb_size, 0), VALUE_PCNT(thumb_ratio) } },
+	{ MTRACK_PROP_PALM_DETECT, 8, 2, {
+		VALUE_BOOL(ignore_palm), VALUE_BOOL(disable_on_palm) } },
+	{ MTRACK_PROP_PALM_SIZE, 32, 1, {
+		VALUE_MIN(palm_size, 0) } },
+	{ MTRACK_PROP_GESTURE_SETTINGS, 16, 2, {
+		VALUE_MIN(gesture_hold, 1), VALUE_MIN(gesture_wait, 0) } },
+	{ MTRACK_PROP_SCROLL_DIST, 32, 1, {
+		VALUE_MIN(scroll_dist, 1) } },
+	{ MTRACK_PROP_SCROLL_BUTTONS, 8, 4, {
+		VALUE_BUTTON(scroll_up_btn), VALUE_BUTTON(scroll_dn_btn),
+		VALUE_BUTTON(scroll_lt_btn), VALUE_BUTTON(scroll_rt_btn) } },
+	{ MTRACK_PROP_SWIPE_DIST, 32, 1, {
+		VALUE_MIN(swipe_dist, 1) } },
+	{ MTRACK_PROP_SWIPE_BUTTONS, 8, 4, {
+		VALUE_BUTTON(swipe_up_btn), VALUE_BUTTON(swipe_dn_btn),
+		VALUE_BUTTON(swipe_lt_btn), VALUE_BUTTON(swipe_rt_btn) } },
+	{ MTRACK_PROP_SWIPE4_DIST, 32, 1, {
+		VALUE_MIN(swipe4_dist, 1) } },
+	{ MTRACK_PROP_SWIPE4_BUTTONS, 8, 4, {
+		VALUE_BUTTON(swipe4_up_btn), VALUE_BUTTON(swipe4_dn_btn),
+		VALUE_BUTTON(swipe4_lt_btn), VALUE_BUTTON(swipe4_rt_btn) } },
+	{ MTRACK_PROP_SCALE_DIST, 32, 1, {
+		VALUE_MIN(scale_dist, 1) } },
+	{ MTRACK_PROP_SCALE_BUTTONS, 8, 2, {
+		VALUE_BUTTON(scale_up_btn), VALUE_BUTTON(scale_dn_btn) } },
+	{ MTRACK_PROP_ROTATE_DIST, 32, 1, {
+		VALUE_MIN(rotate_dist, 1) } },
+	{ MTRACK_PROP_ROTATE_BUTTONS, 8, 2, {
+		VALUE_BUTTON(rotate_lt_btn), VALUE_BUTTON(rotate_rt_btn) } },
+	{ MTRACK_PROP_DRAG_SETTINGS, 32, 4, {
+		VALUE_BOOL(drag_enable), VALUE_MIN(drag_timeout, 1),
+		VALUE_MIN(drag_wait, 0), VALUE_MIN(drag_dist, 0) } },
+};
+
+/* fails to compile if DIM_PROPS is off */
+typedef char props_dim_check[sizeof(props) / sizeof(props[0]) == DIM_PROPS ? 1 : -1];
+
+/* Preset configs, each applied over the config the options give.
+ */
+static void profile_no_tap(struct MConfig *cfg)
+{
+	cfg->tap_1touch = 0;
+	cfg->tap_2touch = 0;
+	cfg->tap_3touch = 0;
+	cfg->tap_4touch = 0;
+	cfg->drag_enable = 0;
+}
 
-struct MProps mprops;
+static void profile_palm_rejection(struct MConfig *cfg)
+{
+	cfg->ignore_thumb = 1;
+	cfg->ignore_palm = 1;
+}
+
+static void profile_precise(struct MConfig *cfg)
+{
+	cfg->sensitivity /= 2;
+	cfg->tap_dist = MAXVAL(cfg->tap_dist / 2, 1);
+	cfg->drag_dist /= 2;
+}
+
+struct MProfile {
+	const char *name;
+	void (*apply)(struct MConfig *cfg);
+};
+
+static const struct MProfile profiles[] = {
+	{ "Default", NULL },
+	{ "No Tap", profile_no_tap },
+	{ "Palm Rejection", profile_palm_rejection },
+	{ "Precise", profile_precise },
+};
+
+/* Fibonacci hashing, the top bits of the product are the well mixed
+ * ones.
+ */
+static unsigned prop_hash(Atom atom)
+{
+	return ((uint32_t)atom * 2654435761u) >> (32 - DIM_PROP_HASH_BITS);
+}
+
+static void hash_add(struct MProps *mp, int index)
+{
+	unsigned h = prop_hash(mp->atom[index]);
+	while (mp->hash[h])
+		h = (h + 1) % DIM_PROP_HASH;
+	mp->hash[h] = index + 1;
+}
+
+/* The registry entry of an atom, or -1 if it is none of ours.
+ */
+static int hash_find(const struct MProps *mp, Atom atom)
+{
+	unsigned h = prop_hash(atom);
+	while (mp->hash[h]) {
+		if (mp->atom[mp->hash[h] - 1] == atom)
+			return mp->hash[h] - 1;
+		h = (h + 1) % DIM_PROP_HASH;
+	}
+	return -1;
+}
 
-Atom atom_init_integer(DeviceIntPtr dev, char* name, int nvalues, int* values, int size) {
-	Atom atom;
+#define int_field(cfg, v) ((int *)((char *)(cfg) + (v)->offset))
+#define float_field(cfg, v) ((double *)((char *)(cfg) + (v)->offset))
+
+/* Give a property the values it has in cfg.
+ */
+static void prop_store(const struct MProps *mp, DeviceIntPtr dev, Atom atom,
+		       const struct MPropDesc *p, const struct MConfig *cfg, BOOL sendevent)
+{
+	uint8_t vals8[MAX_INT_VALUES];
+	uint16_t vals16[MAX_INT_VALUES];
+	uint32_t vals32[MAX_INT_VALUES];
+	float fvals[MAX_FLOAT_VALUES];
+	pointer vals;
 	int i;
-	uint8_t uvals8[MAX_INT_VALUES];
-	uint16_t uvals16[MAX_INT_VALUES];
-	uint32_t uvals32[MAX_INT_VALUES];
-	pointer uvals;
-	nvalues = MINVAL(MAX_INT_VALUES, nvalues);
 
-	switch(size) {
+	switch (p->format) {
+	case 0:
+		for (i = 0; i < p->count; i++)
+			fvals[i] = *float_field(cfg, &p->value[i]);
+		XIChangeDeviceProperty(dev, atom, mp->float_type, 32, PropModeReplace, p->count, fvals, sendevent);
+		return;
 	case 8:
-		for (i = 0; i < nvalues; i++) {
-			uvals8[i] = values[i];
-		}
-		uvals = uvals8;
+		for (i = 0; i < p->count; i++)
+			vals8[i] = *int_field(cfg, &p->value[i]);
+		vals = vals8;
 		break;
 	case 16:
-		for (i = 0; i < nvalues; i++) {
-			uvals16[i] = values[i];
-		}
-		uvals = uvals16;
+		for (i = 0; i < p->count; i++)
+			vals16[i] = *int_field(cfg, &p->value[i]);
+		vals = vals16;
 		break;
 	default:
-		for (i = 0; i < nvalues; i++) {
-			uvals32[i] = values[i];
-		}
-		uvals = uvals32;
+		for (i = 0; i < p->count; i++)
+			vals32[i] = *int_field(cfg, &p->value[i]);
+		vals = vals32;
 		break;
 	}
-
-	atom = MakeAtom(name, strlen(name), TRUE);
-	XIChangeDeviceProperty(dev, atom, XA_INTEGER, size, PropModeReplace, nvalues, uvals, FALSE);
-	XISetDevicePropertyDeletable(dev, atom, FALSE);
-	return atom;
+	XIChangeDeviceProperty(dev, atom, XA_INTEGER, p->format, PropModeReplace, p->count, vals, sendevent);
 }
 
-Atom atom_init_float(DeviceIntPtr dev, char* name, int nvalues, float* values, Atom float_type) {
-	Atom atom = MakeAtom(name, strlen(name), TRUE);
-	XIChangeDeviceProperty(dev, atom, float_type, 32, PropModeReplace, nvalues, values, FALSE);
-	XISetDevicePropertyDeletable(dev, atom, FALSE);
-	return atom;
-}
-
-void mprops_init(struct MConfig* cfg, InputInfoPtr local) {
-	int ivals[MAX_INT_VALUES];
-	float fvals[MAX_FLOAT_VALUES];
+void mprops_init(struct MProps* mp, const struct MConfig* cfg, InputInfoPtr local) {
+	int i;
 
-	mprops.float_type = XIGetKnownProperty(XATOM_FLOAT);
-	if (!mprops.float_type) {
-		mprops.float_type = MakeAtom(XATOM_FLOAT, strlen(XATOM_FLOAT), TRUE);
-		if (!mprops.float_type) {
+	memset(mp, 0, sizeof(*mp));
+	mp->float_type = XIGetKnownProperty(XATOM_FLOAT);
+	if (!mp->float_type) {
+		mp->float_type = MakeAtom(XATOM_FLOAT, strlen(XATOM_FLOAT), TRUE);
+		if (!mp->float_type) {
 			xf86Msg(X_ERROR, "mtrack: %s: Failed to init float atom. Property support is disabled.\n", local->name);
 			return;
 		}
 	}
 
-	ivals[0] = cfg->trackpad_disable;
-	mprops.trackpad_disable = atom_init_integer(local->dev, MTRACK_PROP_TRACKPAD_DISABLE, 1, ivals, 8);
-
-	fvals[0] = (float)cfg->sensitivity;
-	mprops.sensitivity = atom_init_float(local->dev, MTRACK_PROP_SENSITIVITY, 1, fvals, mprops.float_type);
-
-	ivals[0] = cfg->touch_down;
-	ivals[1] = cfg->touch_up;
-	mprops.pressure = atom_init_integer(local->dev, MTRACK_PROP_PRESSURE, 2, ivals, 8);
-
-	ivals[0] = cfg->button_enable;
-	ivals[1] = cfg->button_integrated;
-	ivals[2] = cfg->button_expire;
-	ivals[3] = cfg->button_zones;
-	mprops.button_settings = atom_init_integer(local->dev, MTRACK_PROP_BUTTON_SETTINGS, 4, ivals, 16);
-
-	ivals[0] = cfg->button_1touch;
-	ivals[1] = cfg->button_2touch;
-	ivals[2] = cfg->button_3touch;
-	mprops.button_emulate = atom_init_integer(local->dev, MTRACK_PROP_BUTTON_EMULATE, 3, ivals, 8);
-
-	ivals[0] = cfg->tap_hold;
-	ivals[1] = cfg->tap_timeout;
-	ivals[2] = cfg->tap_dist;
-	mprops.tap_settings = atom_init_integer(local->dev, MTRACK_PROP_TAP_SETTINGS, 3, ivals, 32);
-
-	ivals[0] = cfg->tap_1touch;
-	ivals[1] = cfg->tap_2touch;
-	ivals[2] = cfg->tap_3touch;
-	ivals[3] = cfg->tap_4touch;
-	mprops.tap_emulate = atom_init_integer(local->dev, MTRACK_PROP_TAP_EMULATE, 4, ivals, 8);
-
-	ivals[0] = cfg->ignore_thumb;
-	ivals[1] = cfg->disable_on_thumb;
-	mprops.thumb_detect = atom_init_integer(local->dev, MTRACK_PROP_THUMB_DETECT, 2, ivals, 8);
-
-	ivals[0] = cfg->thumb_size;
-	ivals[1] = cfg->thumb_ratio;
-	mprops.thumb_size = atom_init_integer(local->dev, MTRACK_PROP_THUMB_SIZE, 2, ivals, 32);
-
-	ivals[0] = cfg->ignore_palm;
-	ivals[1] = cfg->disable_on_palm;
-	mprops.palm_detect = atom_init_integer(local->dev, MTRACK_PROP_PALM_DETECT, 2, ivals, 8);
-
-	ivals[0] = cfg->palm_size;
-	mprops.palm_size = atom_init_integer(local->dev, MTRACK_PROP_PALM_SIZE, 1, ivals, 32);
-
-	ivals[0] = cfg->gesture_hold;
-	ivals[1] = cfg->gesture_wait;
-	mprops.gesture_settings = atom_init_integer(local->dev, MTRACK_PROP_GESTURE_SETTINGS, 2, ivals, 16);
-
-	ivals[0] = cfg->scroll_dist;
-	mprops.scroll_dist = atom_init_integer(local->dev, MTRACK_PROP_SCROLL_DIST, 1, ivals, 32);
-
-	ivals[0] = cfg->scroll_up_btn;
-	ivals[1] = cfg->scroll_dn_btn;
-	ivals[2] = cfg->scroll_lt_btn;
-	ivals[3] = cfg->scroll_rt_btn;
-	mprops.scroll_buttons = atom_init_integer(local->dev, MTRACK_PROP_SCROLL_BUTTONS, 4, ivals, 8);
-
-	ivals[0] = cfg->swipe_dist;
-	mprops.swipe_dist = atom_init_integer(local->dev, MTRACK_PROP_SWIPE_DIST, 1, ivals, 32);
-
-	ivals[0] = cfg->swipe_up_btn;
-	ivals[1] = cfg->swipe_dn_btn;
-	ivals[2] = cfg->swipe_lt_btn;
-	ivals[3] = cfg->swipe_rt_btn;
-	mprops.swipe_buttons = atom_init_integer(local->dev, MTRACK_PROP_SWIPE_BUTTONS, 4, ivals, 8);
-
-	ivals[0] = cfg->swipe4_dist;
-	mprops.swipe4_dist = atom_init_integer(local->dev, MTRACK_PROP_SWIPE4_DIST, 1, ivals, 32);
-
-	ivals[0] = cfg->swipe4_up_btn;
-	ivals[1] = cfg->swipe4_dn_btn;
-	ivals[2] = cfg->swipe4_lt_btn;
-	ivals[3] = cfg->swipe4_rt_btn;
-	mprops.swipe4_buttons = atom_init_integer(local->dev, MTRACK_PROP_SWIPE4_BUTTONS, 4, ivals, 8);
-
-	ivals[0] = cfg->scale_dist;
-	mprops.scale_dist = atom_init_integer(local->dev, MTRACK_PROP_SCALE_DIST, 1, ivals, 32);
-
-	ivals[0] = cfg->scale_up_btn;
-	ivals[1] = cfg->scale_dn_btn;
-	mprops.scale_buttons = atom_init_integer(local->dev, MTRACK_PROP_SCALE_BUTTONS, 2, ivals, 8);
-
-	ivals[0] = cfg->rotate_dist;
-	mprops.rotate_dist = atom_init_integer(local->dev, MTRACK_PROP_ROTATE_DIST, 1, ivals, 32);
-
-	ivals[0] = cfg->rotate_lt_btn;
-	ivals[1] = cfg->rotate_rt_btn;
-	mprops.rotate_buttons = atom_init_integer(local->dev, MTRACK_PROP_SCALE_BUTTONS, 2, ivals, 8);
-
-	ivals[0] = cfg->drag_enable;
-	ivals[1] = cfg->drag_timeout;
-	ivals[2] = cfg->drag_wait;
-	ivals[3] = cfg->drag_dist;
-	mprops.drag_settings = atom_init_integer(local->dev, MTRACK_PROP_DRAG_SETTINGS, 4, ivals, 32);
-}
-
-int mprops_set_property(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop, BOOL checkonly) {
-	InputInfoPtr local = dev->public.devicePrivate;
-	struct MConfig* cfg = &((struct MTouch*)local->private)->cfg;
-
-	uint8_t* ivals8;
-	uint16_t* ivals16;
-	uint32_t* ivals32;
-	float* fvals;
-
-	if (property == mprops.trackpad_disable) {
-		if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (ivals8[0] < 0 || ivals8[0] > 3)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->trackpad_disable = ivals8[0];
-#ifdef DEBUG_PROPS
-			if (cfg->trackpad_disable)
-				xf86Msg(X_INFO, "mtrack: trackpad input disabled\n");
-			else
-				xf86Msg(X_INFO, "mtrack: trackpad input enabled\n");
-#endif
-		}
-	}
-	else if (property == mprops.sensitivity) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != mprops.float_type)
-			return BadMatch;
-
-		fvals = (float*)prop->data;
-		if (fvals[0] < 0)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->sensitivity = fvals[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set sensitivity to %f\n", cfg->sensitivity);
-#endif
-		}
-	}
-	else if (property == mprops.pressure) {
-		if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER) 
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_PCNT(ivals8[0]) || !VALID_PCNT(ivals8[1]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->touch_down = ivals8[0];
-			cfg->touch_up = ivals8[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set touch pressure to %d %d\n",
-				cfg->touch_down, cfg->touch_up);
-#endif
-		}
-	}
-	else if (property == mprops.button_settings) {
-		if (prop->size != 4 || prop->format != 16 || prop->type != XA_INTEGER) 
-			return BadMatch;
-
-		ivals16 = (uint16_t*)prop->data;
-		if (!VALID_BOOL(ivals16[0]) || !VALID_BOOL(ivals16[1]) || ivals16[2] < 0 || !VALID_BOOL(ivals16[3]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->button_enable = ivals16[0];
-			cfg->button_integrated = ivals16[1];
-			cfg->button_expire = ivals16[2];
-			cfg->button_zones = ivals16[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set button settings to %d %d %d %d\n",
-				cfg->button_enable, cfg->button_integrated, cfg->button_expire, cfg->button_zones);
-#endif
-		}
-	}
-	else if (property == mprops.button_emulate) {
-		if (prop->size != 3 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->button_1touch = ivals8[0];
-			cfg->button_2touch = ivals8[1];
-			cfg->button_3touch = ivals8[2];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set button emulation to %d %d %s\n",
-				cfg->button_1touch, cfg->button_2touch, cfg->button_3touch);
-#endif
-		}
-	}
-	else if (property == mprops.tap_settings) {
-		if (prop->size != 3 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1 || ivals32[1] < 1 || ivals32[2] < 1)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->tap_hold = ivals32[0];
-			cfg->tap_timeout = ivals32[1];
-			cfg->tap_dist = ivals32[2];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set tap settings to %d %d %d\n",
-				cfg->tap_hold, cfg->tap_timeout, cfg->tap_dist);
-#endif
-		}
-	}
-	else if (property == mprops.tap_emulate) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
-
-		if (!checkonly) {			
-			cfg->tap_1touch = ivals8[0];
-			cfg->tap_2touch = ivals8[1];
-			cfg->tap_3touch = ivals8[2];
-			cfg->tap_4touch = ivals8[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set tap emulation to %d %d %d %d\n",
-				cfg->tap_1touch, cfg->tap_2touch, cfg->tap_3touch, cfg->tap_4touch);
-#endif
-		}
-	}
-	else if (property == mprops.thumb_detect) {
-		if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BOOL(ivals8[0]) || !VALID_BOOL(ivals8[1]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->ignore_thumb = ivals8[0];
-			cfg->disable_on_thumb = ivals8[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set thumb detect to %d %d\n",
-				cfg->ignore_thumb, cfg->disable_on_thumb);
-#endif
-		}
-	}
-	else if (property == mprops.thumb_size) {
-		if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 0 || !VALID_PCNT(ivals32[1]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->thumb_size = ivals32[0];
-			cfg->thumb_ratio = ivals32[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set thumb size to %d %d\n",
-				cfg->thumb_size, cfg->thumb_ratio);
-#endif
-		}
-	}
-	else if (property == mprops.palm_detect) {
-		if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BOOL(ivals8[0]) || !VALID_BOOL(ivals8[1]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->ignore_palm = ivals8[0];
-			cfg->disable_on_palm = ivals8[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set palm detect to %d %d\n",
-				cfg->ignore_palm, cfg->disable_on_palm);
-#endif
-		}
-	}
-	else if (property == mprops.palm_size) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 0)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->palm_size = ivals32[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set palm size to %d\n",
-				cfg->palm_size);
-#endif
-		}
+	for (i = 0; i < DIM_PROPS; i++) {
+		mp->atom[i] = MakeAtom(props[i].name, strlen(props[i].name), TRUE);
+		prop_store(mp, local->dev, mp->atom[i], &props[i], cfg, FALSE);
+		XISetDevicePropertyDeletable(local->dev, mp->atom[i], FALSE);
+		hash_add(mp, i);
 	}
-	else if (property == mprops.gesture_settings) {
-		if (prop->size != 2 || prop->format != 16 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals16 = (uint16_t*)prop->data;
-		if (ivals16[0] < 1 || ivals16[1] < 0)
-			return BadMatch;
 
-		if (!checkonly) {
-			cfg->gesture_hold = ivals16[0];
-			cfg->gesture_wait = ivals16[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set gesture settings to %d %d\n",
-				cfg->gesture_hold, cfg->gesture_wait);
-#endif
-		}
-	}
-	else if (property == mprops.scroll_dist) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
+	mp->profile = MakeAtom(MTRACK_PROP_PROFILE, strlen(MTRACK_PROP_PROFILE), TRUE);
+	XIChangeDeviceProperty(local->dev, mp->profile, XA_STRING, 8, PropModeReplace,
+			       strlen(profiles[0].name), (pointer)profiles[0].name, FALSE);
+	XISetDevicePropertyDeletable(local->dev, mp->profile, FALSE);
+	mp->base = *cfg;
+}
 
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1)
-			return BadMatch;
+/* Check the values of a property against its registry entry, and store
+ * them in cfg unless only checking.
+ */
+static int set_values(const struct MProps *mp, const struct MPropDesc *p,
+		      XIPropertyValuePtr prop, struct MConfig *cfg, BOOL checkonly) {
+	int ivals[MAX_INT_VALUES];
+	float *fvals = prop->data;
+	int i;
 
-		if (!checkonly) {
-			cfg->scroll_dist = ivals32[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set scroll distance to %d\n",
-				cfg->scroll_dist);
-#endif
-		}
+	if (prop->size != p->count)
+		return BadMatch;
+	if (p->format ? prop->format != p->format || prop->type != XA_INTEGER
+		      : prop->format != 32 || prop->type != mp->float_type)
+		return BadMatch;
+
+	if (!p->format) {
+		for (i = 0; i < p->count; i++)
+			if (!isfinite(fvals[i]) ||
+			    fvals[i] < p->value[i].min || fvals[i] > p->value[i].max)
+				return BadMatch;
+		if (!checkonly)
+			for (i = 0; i < p->count; i++)
+				*float_field(cfg, &p->value[i]) = fvals[i];
+		return Success;
 	}
-	else if (property == mprops.scroll_buttons) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
 
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->scroll_up_btn = ivals8[0];
-			cfg->scroll_dn_btn = ivals8[1];
-			cfg->scroll_lt_btn = ivals8[2];
-			cfg->scroll_rt_btn = ivals8[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set scroll buttons to %d %d %d %d\n",
-				cfg->scroll_up_btn, cfg->scroll_dn_btn, cfg->scroll_lt_btn, cfg->scroll_rt_btn);
-#endif
+	for (i = 0; i < p->count; i++) {
+		switch (p->format) {
+		case 8:
+			ivals[i] = ((uint8_t*)prop->data)[i];
+			break;
+		case 16:
+			ivals[i] = ((uint16_t*)prop->data)[i];
+			break;
+		default:
+			ivals[i] = ((int32_t*)prop->data)[i];
+			break;
 		}
-	}
-	else if (property == mprops.swipe_dist) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
+		if (ivals[i] < p->value[i].min || ivals[i] > p->value[i].max)
 			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->swipe_dist = ivals32[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set swipe distance to %d\n",
-				cfg->swipe_dist);
-#endif
-		}
 	}
-	else if (property == mprops.swipe_buttons) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->swipe_up_btn = ivals8[0];
-			cfg->swipe_dn_btn = ivals8[1];
-			cfg->swipe_lt_btn = ivals8[2];
-			cfg->swipe_rt_btn = ivals8[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set swipe buttons to %d %d %d %d\n",
-				cfg->swipe_up_btn, cfg->swipe_dn_btn, cfg->swipe_lt_btn, cfg->swipe_rt_btn);
-#endif
-		}
-	}
-	else if (property == mprops.swipe4_dist) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1)
-			return BadMatch;
+	if (!checkonly)
+		for (i = 0; i < p->count; i++)
+			*int_field(cfg, &p->value[i]) = ivals[i];
+	return Success;
+}
 
-		if (!checkonly) {
-			cfg->swipe4_dist = ivals32[0];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set swipe4 distance to %d\n",
-				cfg->swipe4_dist);
-#endif
-		}
+/* Switch to the profile a string property names: the settings the
+ * options gave with the preset applied. The trackpad disable and
+ * passthrough switches are left as they are. The other properties are
+ * updated to match.
+ */
+static int set_profile(struct MProps *mp, DeviceIntPtr dev, XIPropertyValuePtr prop,
+		       struct MConfig *cfg, BOOL checkonly) {
+	const struct MProfile *profile = NULL;
+	int trackpad_disable = cfg->trackpad_disable;
+	int passthrough = cfg->passthrough;
+	int i, j;
+
+	if (prop->format != 8 || prop->type != XA_STRING)
+		return BadMatch;
+	for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+		if (strlen(profiles[i].name) == prop->size &&
+		    !strncmp(profiles[i].name, prop->data, prop->size))
+			profile = &profiles[i];
 	}
-	else if (property == mprops.swipe4_buttons) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->swipe4_up_btn = ivals8[0];
-			cfg->swipe4_dn_btn = ivals8[1];
-			cfg->swipe4_lt_btn = ivals8[2];
-			cfg->swipe4_rt_btn = ivals8[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set swipe4 buttons to %d %d %d %d\n",
-				cfg->swipe4_up_btn, cfg->swipe4_dn_btn, cfg->swipe4_lt_btn, cfg->swipe4_rt_btn);
-#endif
+	if (!profile)
+		return BadMatch;
+	if (checkonly)
+		return Success;
+
+	for (i = 0; i < DIM_PROPS; i++) {
+		for (j = 0; j < props[i].count; j++) {
+			if (props[i].format)
+				*int_field(cfg, &props[i].value[j]) = *int_field(&mp->base, &props[i].value[j]);
+			else
+				*float_field(cfg, &props[i].value[j]) = *float_field(&mp->base, &props[i].value[j]);
 		}
 	}
-	else if (property == mprops.scale_dist) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->scale_dist = ivals32[0];
+	if (profile->apply)
+		profile->apply(cfg);
+	cfg->trackpad_disable = trackpad_disable;
+	cfg->passthrough = passthrough;
 #ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set scale distance to %d\n",
-				cfg->scale_dist);
+	xf86Msg(X_INFO, "mtrack: switched to profile %s\n", profile->name);
 #endif
-		}
-	}
-	else if (property == mprops.scale_buttons) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
 
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
+	mp->updating = 1;
+	for (i = 0; i < DIM_PROPS; i++)
+		prop_store(mp, dev, mp->atom[i], &props[i], cfg, TRUE);
+	mp->updating = 0;
+	return Success;
+}
 
-		if (!checkonly) {
-			cfg->scale_up_btn = ivals8[0];
-			cfg->scale_dn_btn = ivals8[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set scale buttons to %d %d\n",
-				cfg->scale_up_btn, cfg->scale_dn_btn);
+/* Runs on the main thread while packets may be processed on the input
+ * or reader thread. Those only see cfg once a change is complete and
+ * published as a whole, so a packet is processed with either the old
+ * config or the new one, never a mix.
+ */
+int mprops_set_property(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop, BOOL checkonly) {
+	InputInfoPtr local = dev->public.devicePrivate;
+	struct MTouch *mt = local->private;
+#ifdef HAVE_SMOOTH_SCROLL
+	int scroll_dist = mt->cfg.scroll_dist;
 #endif
-		}
-	}
-	else if (property == mprops.rotate_dist) {
-		if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
+	int i, rc;
 
-		ivals32 = (uint32_t*)prop->data;
-		if (ivals32[0] < 1)
-			return BadMatch;
+	/* our own updates after a profile switch, already in cfg */
+	if (mt->props.updating)
+		return Success;
 
-		if (!checkonly) {
-			cfg->rotate_dist = ivals32[0];
+	if (property == mt->props.profile)
+		rc = set_profile(&mt->props, dev, prop, &mt->cfg, checkonly);
+	else if ((i = hash_find(&mt->props, property)) >= 0) {
+		rc = set_values(&mt->props, &props[i], prop, &mt->cfg, checkonly);
 #ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set rotate distance to %d\n",
-				cfg->rotate_dist);
+		if (rc == Success && !checkonly)
+			xf86Msg(X_INFO, "mtrack: set %s\n", props[i].name);
 #endif
-		}
 	}
-	else if (property == mprops.rotate_buttons) {
-		if (prop->size != 4 || prop->format != 8 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals8 = (uint8_t*)prop->data;
-		if (!VALID_BUTTON(ivals8[0]) || !VALID_BUTTON(ivals8[1]) || !VALID_BUTTON(ivals8[2]) || !VALID_BUTTON(ivals8[3]))
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->rotate_lt_btn = ivals8[0];
-			cfg->rotate_rt_btn = ivals8[1];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set rotate buttons to %d %d\n",
-				cfg->rotate_lt_btn, cfg->rotate_rt_btn);
-#endif
-		}
+	else
+		return Success;
+	if (rc != Success || checkonly)
+		return rc;
+
+#ifdef HAVE_SMOOTH_SCROLL
+	if (mt->cfg.scroll_dist != scroll_dist) {
+		SetScrollValuator(dev, 2, SCROLL_TYPE_HORIZONTAL,
+				  mt->cfg.scroll_dist, SCROLL_FLAG_NONE);
+		SetScrollValuator(dev, 3, SCROLL_TYPE_VERTICAL,
+				  mt->cfg.scroll_dist, SCROLL_FLAG_PREFERRED);
 	}
-	else if (property == mprops.drag_settings) {
-		if (prop->size != 4 || prop->format != 32 || prop->type != XA_INTEGER)
-			return BadMatch;
-
-		ivals32 = (uint32_t*)prop->data;
-		if (!VALID_BOOL(ivals32[0]) || ivals32[1] < 1 || ivals32[2] < 0 || ivals32[3] < 0)
-			return BadMatch;
-
-		if (!checkonly) {
-			cfg->drag_enable = ivals32[0];
-			cfg->drag_timeout = ivals32[1];
-			cfg->drag_wait = ivals32[2];
-			cfg->drag_dist = ivals32[3];
-#ifdef DEBUG_PROPS
-			xf86Msg(X_INFO, "mtrack: set drag settings to %d %d %d %d\n",
-				cfg->drag_enable, cfg->drag_timeout, cfg->drag_wait, cfg->drag_dist);
 #endif
-		}
-	}
-
+	mtouch_publish_config(mt);
 	return Success;
 }
-
@@ -22,6 +22,7 @@
 
 #include "mtouch.h"
 #include "mprops.h"
+#include "reader.h"
 
 #include <xf86Module.h>
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
@@ -38,6 +39,12 @@
 #define SCALE_THRESHOLD 0.15
 #define ROTATE_THRESHOLD 0.15
 
+#ifdef HAVE_SMOOTH_SCROLL
+#define DIM_AXES 4
+#else
+#define DIM_AXES 2
+#endif
+
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 12
 typedef InputInfoPtr LocalDevicePtr;
 #endif
@@ -53,11 +60,15 @@ static void pointer_control(DeviceIntPtr dev, PtrCtrl *ctrl)
 }
 
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
-static void initAxesLabels(Atom map[2])
+static void initAxesLabels(Atom map[DIM_AXES])
 {
-	memset(map, 0, 2 * sizeof(Atom));
+	memset(map, 0, DIM_AXES * sizeof(Atom));
 	PROPMAP(map, 0, AXIS_LABEL_PROP_REL_X);
 	PROPMAP(map, 1, AXIS_LABEL_PROP_REL_Y);
+#ifdef HAVE_SMOOTH_SCROLL
+	PROPMAP(map, 2, AXIS_LABEL_PROP_REL_HSCROLL);
+	PROPMAP(map, 3, AXIS_LABEL_PROP_REL_VSCROLL);
+#endif
 }
 
 static void initButtonLabels(Atom map[DIM_BUTTON])
@@ -90,7 +101,7 @@ static int device_init(DeviceIntPtr dev, LocalDevicePtr local)
 		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
 	};
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
-	Atom axes_labels[2], btn_labels[DIM_BUTTON];
+	Atom axes_labels[DIM_AXES], btn_labels[DIM_BUTTON];
 	initAxesLabels(axes_labels);
 	initButtonLabels(btn_labels);
 #endif
@@ -124,7 +135,7 @@ static int device_init(DeviceIntPtr dev, LocalDevicePtr local)
 				btmap, DIM_BUTTON, btn_labels,
 				pointer_control,
 				GetMotionHistorySize(),
-				2, axes_labels);
+				DIM_AXES, axes_labels);
 #else
 #error "Unsupported ABI_XINPUT_VERSION"
 #endif
@@ -153,7 +164,30 @@ static int device_init(DeviceIntPtr dev, LocalDevicePtr local)
 				   1, 0, 1);
 #endif
 	xf86InitValuatorDefaults(dev, 1);
-	mprops_init(&mt->cfg, local);
+#ifdef HAVE_GESTURE_EVENTS
+	InitGestureClassDeviceStruct(dev, 4);
+#endif
+#ifdef HAVE_TOUCH_EVENTS
+	InitTouchClassDeviceStruct(dev, DIM_FINGER, XIDependentTouch, 2);
+#endif
+#ifdef HAVE_SMOOTH_SCROLL
+	xf86InitValuatorAxisStruct(dev, 2, axes_labels[2],
+				   NO_AXIS_LIMITS, NO_AXIS_LIMITS,
+				   0, 0, 0, Relative);
+	xf86InitValuatorAxisStruct(dev, 3, axes_labels[3],
+				   NO_AXIS_LIMITS, NO_AXIS_LIMITS,
+				   0, 0, 0, Relative);
+	SetScrollValuator(dev, 2, SCROLL_TYPE_HORIZONTAL,
+			  mt->cfg.scroll_dist, SCROLL_FLAG_NONE);
+	SetScrollValuator(dev, 3, SCROLL_TYPE_VERTICAL,
+			  mt->cfg.scroll_dist, SCROLL_FLAG_PREFERRED);
+#endif
+#if defined(HAVE_SMOOTH_SCROLL) || defined(HAVE_TOUCH_EVENTS)
+	mt->valuators = valuator_mask_new(DIM_AXES);
+	if (!mt->valuators)
+		return BadAlloc;
+#endif
+	mprops_init(&mt->props, &mt->cfg, local);
 	XIRegisterPropertyHandler(dev, mprops_set_property, NULL, NULL);
 
 	return Success;
@@ -171,6 +205,16 @@ static int device_on(LocalDevicePtr local)
 		xf86Msg(X_ERROR, "mtrack: cannot grab device\n");
 		return !Success;
 	}
+	/* with a reader thread, read_input only posts what it queued */
+	if (mt->cfg.reader_thread) {
+		int fd = reader_start(mt, local->fd);
+		if (fd < 0)
+			xf86Msg(X_WARNING, "mtrack: cannot start reader thread, reading on the main loop\n");
+		else
+			local->fd = fd;
+	}
+	/* registers the fd with the input thread on servers that have
+	 * one, read_input then runs there under the input lock */
 	xf86AddEnabledDevice(local);
 	return Success;
 }
@@ -179,6 +223,11 @@ static int device_off(LocalDevicePtr local)
 {
 	struct MTouch *mt = local->private;
 	xf86RemoveEnabledDevice(local);
+	TimerCancel(mt->timer);
+	if (mt->reader) {
+		local->fd = mt->reader->fd;
+		reader_stop(mt);
+	}
 	if (mtouch_close(mt, local->fd))
 		xf86Msg(X_WARNING, "mtrack: cannot ungrab device\n");
 	xf86CloseSerial(local->fd);
@@ -187,45 +236,275 @@ static int device_off(LocalDevicePtr local)
 
 static int device_close(LocalDevicePtr local)
 {
+	struct MTouch *mt = local->private;
+	TimerFree(mt->timer);
+	mt->timer = NULL;
+#if defined(HAVE_SMOOTH_SCROLL) || defined(HAVE_TOUCH_EVENTS)
+	valuator_mask_free(&mt->valuators);
+#endif
 	return Success;
 }
 
 static void handle_gestures(LocalDevicePtr local,
 			const struct Gestures* gs)
 {
-	static bitmask_t buttons_prev = 0U;
+	const struct ButtonEvent *ev;
 	int i;
 
-	for (i = 0; i < 32; i++) {
-		if (GETBIT(gs->buttons, i) == GETBIT(buttons_prev, i))
-			continue;
-		if (GETBIT(gs->buttons, i)) {
-			xf86PostButtonEvent(local->dev, FALSE, i+1, 1, 0, 0);
+	for (i = 0; i < gs->button_count; i++) {
+		ev = &gs->button_events[i];
+		xf86PostButtonEvent(local->dev, FALSE, ev->button+1, ev->down, 0, 0);
 #if DEBUG_DRIVER
-			xf86Msg(X_INFO, "button %d down\n", i+1);
+		xf86Msg(X_INFO, "button %d %s\n", ev->button+1, ev->down ? "down" : "up");
 #endif
+	}
+
+#ifdef HAVE_SMOOTH_SCROLL
+	if (gs->scroll_dx != 0 || gs->scroll_dy != 0) {
+		struct MTouch *mt = local->private;
+		valuator_mask_zero(mt->valuators);
+		if (gs->move_dx != 0 || gs->move_dy != 0) {
+			valuator_mask_set(mt->valuators, 0, gs->move_dx);
+			valuator_mask_set(mt->valuators, 1, gs->move_dy);
 		}
-		else {
-			xf86PostButtonEvent(local->dev, FALSE, i+1, 0, 0, 0);
-#if DEBUG_DRIVER
-			xf86Msg(X_INFO, "button %d up\n", i+1);
+		if (gs->scroll_dx != 0)
+			valuator_mask_set(mt->valuators, 2, gs->scroll_dx);
+		if (gs->scroll_dy != 0)
+			valuator_mask_set(mt->valuators, 3, gs->scroll_dy);
+		xf86PostMotionEventM(local->dev, Relative, mt->valuators);
+		return;
+	}
+#endif
+	if (gs->move_dx != 0 || gs->move_dy != 0)
+		xf86PostMotionEvent(local->dev, 0, 0, 2, gs->move_dx, gs->move_dy);
+}
+
+static CARD32 timeout_timer(OsTimerPtr timer, CARD32 now, pointer arg);
+
+/* Timer delay for a deadline ms away. A delay of 0 cancels a timer
+ * instead of firing it, so a deadline already due waits 1 ms.
+ */
+static CARD32 timeout_delay(int ms)
+{
+	return ms < 0 ? 0 : MAXVAL(ms, 1);
+}
+
+/* arm the timer for the next gesture deadline, or cancel it */
+static void schedule_timeout(LocalDevicePtr local)
+{
+	struct MTouch *mt = local->private;
+	int ms = mtouch_timeout(mt);
+	if (ms < 0)
+		TimerCancel(mt->timer);
+	else
+		mt->timer = TimerSet(mt->timer, 0, timeout_delay(ms), timeout_timer, local);
+}
+
+#ifdef HAVE_GESTURE_EVENTS
+static void handle_gesture_events(LocalDevicePtr local,
+			const struct Gestures* gs)
+{
+	int type;
+
+	if (gs->gesture_ended == GS_GESTURE_PINCH)
+		xf86PostGestureEvent(local->dev, XI_GesturePinchEnd,
+			gs->gesture_ended_fingers, 0, 0, 0, 0, 0,
+			gs->gesture_scale, 0);
+	else if (gs->gesture_ended == GS_GESTURE_SWIPE)
+		xf86PostGestureEvent(local->dev, XI_GestureSwipeEnd,
+			gs->gesture_ended_fingers, 0, 0, 0, 0, 0, 0, 0);
+
+	if (gs->gesture_type == GS_GESTURE_PINCH) {
+		type = gs->gesture_begin ? XI_GesturePinchBegin : XI_GesturePinchUpdate;
+		xf86PostGestureEvent(local->dev, type, gs->gesture_fingers, 0,
+			gs->gesture_dx, gs->gesture_dy,
+			gs->gesture_dx, gs->gesture_dy,
+			gs->gesture_scale, gs->gesture_angle);
+	}
+	else if (gs->gesture_type == GS_GESTURE_SWIPE) {
+		type = gs->gesture_begin ? XI_GestureSwipeBegin : XI_GestureSwipeUpdate;
+		xf86PostGestureEvent(local->dev, type, gs->gesture_fingers, 0,
+			gs->gesture_dx, gs->gesture_dy,
+			gs->gesture_dx, gs->gesture_dy, 0, 0);
+	}
+}
 #endif
+
+#ifdef HAVE_TOUCH_EVENTS
+/* post a touch, at the position of a slot unless slot is -1 */
+static void post_touch(LocalDevicePtr local, int id, int type,
+		       const struct SlotFrame *sf, int slot)
+{
+	struct MTouch *mt = local->private;
+	valuator_mask_zero(mt->valuators);
+	if (slot >= 0) {
+		valuator_mask_set(mt->valuators, 0, sf->x[slot]);
+		valuator_mask_set(mt->valuators, 1, sf->y[slot]);
+	}
+	xf86PostTouchEvent(local->dev, id, type, 0, mt->valuators);
+}
+
+/* post the hardware slots as touches, bypassing the gestures */
+static void handle_touches(LocalDevicePtr local, const struct SlotFrame *sf)
+{
+	struct MTouch *mt = local->private;
+	int i;
+
+	foreach_bit(i, mt->passthrough_used) {
+		if (!GETBIT(sf->used, i) || sf->tracking_id[i] != mt->passthrough_id[i]) {
+			post_touch(local, mt->passthrough_id[i], XI_TouchEnd, sf, -1);
+			CLEARBIT(mt->passthrough_used, i);
+		}
+	}
+	foreach_bit(i, sf->used) {
+		if (GETBIT(mt->passthrough_used, i)) {
+			if (GETBIT(sf->moved, i))
+				post_touch(local, mt->passthrough_id[i], XI_TouchUpdate, sf, i);
+			continue;
 		}
+		mt->passthrough_id[i] = sf->tracking_id[i];
+		SETBIT(mt->passthrough_used, i);
+		post_touch(local, mt->passthrough_id[i], XI_TouchBegin, sf, i);
+	}
+}
+
+/* end the touches passthrough left, on going back to gestures */
+static void end_touches(LocalDevicePtr local)
+{
+	struct MTouch *mt = local->private;
+	int i;
+	foreach_bit(i, mt->passthrough_used)
+		post_touch(local, mt->passthrough_id[i], XI_TouchEnd, NULL, -1);
+	mt->passthrough_used = 0;
+}
+#endif
+
+/* Follow a change of the passthrough property, ending whatever the old
+ * mode still holds.
+ */
+static void update_mode(LocalDevicePtr local)
+{
+	struct MTouch *mt = local->private;
+
+	if (!mtouch_update_mode(mt))
+		return;
+	if (mt->passthrough) {
+		TimerCancel(mt->timer);
+		handle_gestures(local, &mt->gs);
+#ifdef HAVE_GESTURE_EVENTS
+		handle_gesture_events(local, &mt->gs);
+#endif
 	}
-	buttons_prev = gs->buttons;
+#ifdef HAVE_TOUCH_EVENTS
+	else
+		end_touches(local);
+#endif
+#if DEBUG_DRIVER
+	xf86Msg(X_INFO, "touch passthrough %s\n", mt->passthrough ? "on" : "off");
+#endif
+}
 
-	if (gs->move_dx != 0 || gs->move_dy != 0)
-		xf86PostMotionEvent(local->dev, 0, 0, 2, gs->move_dx, gs->move_dy);
+/* the reader thread stopped on an error, read on the main loop as
+ * without it */
+static CARD32 reader_lost(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+	LocalDevicePtr local = arg;
+	struct MTouch *mt = local->private;
+	if (!mt->reader)
+		return 0;
+	xf86Msg(X_WARNING, "mtrack: reader thread stopped, error %d, reading on the main loop\n",
+		reader_error(mt->reader));
+	xf86RemoveEnabledDevice(local);
+	local->fd = mt->reader->fd;
+	reader_stop(mt);
+	xf86AddEnabledDevice(local);
+	schedule_timeout(local);
+	return 0;
+}
+
+/* post the frames the reader thread queued, in order */
+static void read_frames(LocalDevicePtr local)
+{
+	struct MTouch *mt = local->private;
+	const struct ReaderFrame *f;
+	reader_drain(mt->reader);
+	while ((f = reader_peek(mt->reader))) {
+		mtouch_log_warnings(&f->warn);
+#ifdef HAVE_TOUCH_EVENTS
+		if (f->passthrough) {
+			handle_touches(local, &f->slots);
+			reader_pop(mt->reader);
+			continue;
+		}
+		if (mt->passthrough_used)
+			end_touches(local);
+#endif
+		handle_gestures(local, &f->gs);
+#ifdef HAVE_GESTURE_EVENTS
+		/* deadlines never start or end a gesture, and their
+		 * frames still hold the last pinch or swipe; a switch
+		 * to passthrough only ends one */
+		if (f->evtime || f->gs.gesture_ended != GS_GESTURE_NONE)
+			handle_gesture_events(local, &f->gs);
+#endif
+		reader_pop(mt->reader);
+	}
+	/* input may be read from a signal handler, fall back later */
+	if (reader_error(mt->reader))
+		mt->timer = TimerSet(mt->timer, 0, 1, reader_lost, local);
 }
 
 /* called for each full received packet from the touchpad */
 static void read_input(LocalDevicePtr local)
 {
 	struct MTouch *mt = local->private;
-	while (read_packet(mt, local->fd) > 0)
+	struct MWarnings warn;
+	if (mt->reader) {
+		read_frames(local);
+		return;
+	}
+	update_mode(local);
+	while (read_packet(mt, local->fd) > 0) {
+#ifdef HAVE_TOUCH_EVENTS
+		if (mt->passthrough) {
+			struct SlotFrame sf;
+			slotframe_extract(&sf, &mt->hs);
+			handle_touches(local, &sf);
+			continue;
+		}
+#endif
 		handle_gestures(local, &mt->gs);
-	if (has_delayed(mt, local->fd))
+#ifdef HAVE_GESTURE_EVENTS
+		handle_gesture_events(local, &mt->gs);
+#endif
+	}
+	mtouch_take_warnings(mt, &warn);
+	mtouch_log_warnings(&warn);
+	schedule_timeout(local);
+}
+
+/* fires when no packet arrived before a gesture deadline was due */
+static CARD32 timeout_timer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+	LocalDevicePtr local = arg;
+	struct MTouch *mt = local->private;
+	int ms;
+	/* keep input processing out, older servers read input from the
+	 * SIGIO handler */
+#ifdef HAVE_INPUT_THREAD
+	input_lock();
+#else
+	int sigstate = xf86BlockSIGIO();
+#endif
+	if (read_timeouts(mt, local->fd))
 		handle_gestures(local, &mt->gs);
+	ms = mtouch_timeout(mt);
+#ifdef HAVE_INPUT_THREAD
+	input_unlock();
+#else
+	xf86UnblockSIGIO(sigstate);
+#endif
+	return timeout_delay(ms);
 }
 
 static Bool device_control(DeviceIntPtr dev, int mode)
@@ -270,6 +549,18 @@ static int preinit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
     xf86OptionListReport(pInfo->options);
     xf86ProcessCommonOptions(pInfo, pInfo->options);
     mconfig_configure(&mt->cfg, pInfo->options);
+#ifndef HAVE_SMOOTH_SCROLL
+	mt->cfg.scroll_smooth = 0;
+#endif
+#ifndef HAVE_GESTURE_EVENTS
+	mt->cfg.gesture_events = 0;
+#endif
+#ifndef HAVE_TOUCH_EVENTS
+	mt->cfg.passthrough = 0;
+#endif
+#ifdef HAVE_INPUT_THREAD
+	mt->cfg.reader_thread = 0;
+#endif
 
 	return Success;
 }
@@ -296,6 +587,9 @@ static InputInfoPtr preinit(InputDriverPtr drv, IDevPtr dev, int flags)
 	xf86OptionListReport(local->options);
 	xf86ProcessCommonOptions(local, local->options);
 	mconfig_configure(&mt->cfg, local->options);
+	mt->cfg.scroll_smooth = 0;
+	mt->cfg.gesture_events = 0;
+	mt->cfg.passthrough = 0;
 
 	local->flags |= XI86_CONFIGURED;
  error:
@@ -35,18 +35,52 @@
 #include <mtdev-mapping.h>
 #include <stdint.h>
 
-#define DIM_FINGER 32
-#define DIM_TOUCHES 32
+/* scroll valuators and touch events appeared in server 1.12 */
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 16
+#define HAVE_SMOOTH_SCROLL 1
+#define HAVE_TOUCH_EVENTS 1
+#endif
+
+/* the input thread and input_lock appeared in server 1.19 */
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 23
+#define HAVE_INPUT_THREAD 1
+#endif
+
+/* gesture events appeared in server 21.1 */
+#if ABI_XINPUT_VERSION >= SET_ABI_VERSION(24, 4)
+#define HAVE_GESTURE_EVENTS 1
+#endif
 
-/* year-proof millisecond event time */
-typedef __u64 mstime_t;
+/* Width of all bit masks, which is also the number of slots and
+ * touches tracked. Large touch tables need 64 or 128.
+ */
+#ifndef MT_BITMASK_BITS
+#define MT_BITMASK_BITS 32
+#endif
+
+#define DIM_FINGER MT_BITMASK_BITS
+#define DIM_TOUCHES MT_BITMASK_BITS
+
+/* year-proof microsecond event time */
+typedef __u64 ustime_t;
+
+/* convert a configured millisecond interval to event time */
+#define MS2US(ms) ((ustime_t)(ms) * 1000)
 
 /* all bit masks have this type */
+#if MT_BITMASK_BITS == 32
 typedef unsigned int bitmask_t;
+#elif MT_BITMASK_BITS == 64
+typedef unsigned long long bitmask_t;
+#elif MT_BITMASK_BITS == 128
+typedef unsigned __int128 bitmask_t;
+#else
+#error "MT_BITMASK_BITS must be 32, 64 or 128"
+#endif
 
-#define BITMASK(x) (1U << (x))
-#define BITONES(x) (BITMASK(x) - 1U)
-#define GETBIT(m, x) (((m) >> (x)) & 1U)
+#define BITMASK(x) ((bitmask_t)1 << (x))
+#define BITONES(x) (BITMASK(x) - 1)
+#define GETBIT(m, x) ((int)((m) >> (x)) & 1)
 #define SETBIT(m, x) (m |= BITMASK(x))
 #define CLEARBIT(m, x) (m &= ~BITMASK(x))
 #define MODBIT(m, x, b) ((b) ? SETBIT(m, x) : CLEARBIT(m, x))
@@ -71,20 +105,60 @@ static inline int dist2(int dx, int dy)
 	return dx * dx + dy * dy;
 }
 
-/* Count number of bits (Sean Eron Andersson's Bit Hacks) */
-static inline int bitcount(unsigned v)
+/* Count number of bits */
+static inline int bitcount(bitmask_t v)
 {
-	v -= ((v>>1) & 0x55555555);
-	v = (v&0x33333333) + ((v>>2) & 0x33333333);
-	return (((v + (v>>4)) & 0xF0F0F0F) * 0x1010101) >> 24;
+#if MT_BITMASK_BITS == 32
+	return __builtin_popcount(v);
+#elif MT_BITMASK_BITS == 64
+	return __builtin_popcountll(v);
+#else
+	return __builtin_popcountll((unsigned long long)v) +
+		__builtin_popcountll((unsigned long long)(v >> 64));
+#endif
+}
+
+/* Return index of first bit, -1 on zero */
+static inline int firstbit(bitmask_t v)
+{
+#if MT_BITMASK_BITS == 32
+	return __builtin_ffs(v) - 1;
+#elif MT_BITMASK_BITS == 64
+	return __builtin_ffsll(v) - 1;
+#else
+	unsigned long long lo = v, hi = v >> 64;
+	if (lo)
+		return __builtin_ctzll(lo);
+	return hi ? 64 + __builtin_ctzll(hi) : -1;
+#endif
+}
+
+/* Return index of last bit, -1 on zero */
+static inline int lastbit(bitmask_t v)
+{
+#if MT_BITMASK_BITS == 32
+	return v ? 31 - __builtin_clz(v) : -1;
+#elif MT_BITMASK_BITS == 64
+	return v ? 63 - __builtin_clzll(v) : -1;
+#else
+	unsigned long long hi = v >> 64;
+	if (hi)
+		return 127 - __builtin_clzll(hi);
+	return v ? 63 - __builtin_clzll((unsigned long long)v) : -1;
+#endif
 }
 
-/* Return index of first bit [0-31], -1 on zero */
-#define firstbit(v) (__builtin_ffs(v) - 1)
+/* Inline even where it is big. Lets a generic function with constant
+ * arguments be stamped out as specialized copies.
+ */
+#define force_inline inline __attribute__((always_inline))
 
-/* boost-style foreach bit */
+/* Loop over the bits set in m, lowest first. The mask is read once,
+ * changing it in the loop does not change the bits visited.
+ */
 #define foreach_bit(i, m)						\
-	for (i = firstbit(m); i >= 0; i = firstbit((m) & (~0U << i + 1)))
+	for (bitmask_t _fb_m = (m); _fb_m && ((i) = firstbit(_fb_m), 1);	\
+	     _fb_m &= _fb_m - 1)
 
 /* robust system ioctl calls */
 #define SYSCALL(call) while (((call) == -1) && (errno == EINTR))
@@ -28,9 +28,6 @@
 #include "hwstate.h"
 #include "mtstate.h"
 
-#define GS_TAP 0
-#define GS_BUTTON 1
-
 #define GS_NONE 0
 #define GS_MOVE 1
 #define GS_SCROLL 2
@@ -41,6 +38,24 @@
 #define GS_DRAG_WAIT 7
 #define GS_DRAG_ACTIVE 8
 
+#define GS_GESTURE_NONE 0
+#define GS_GESTURE_PINCH 1
+#define GS_GESTURE_SWIPE 2
+
+/* Deadlines that expire on their own, without waiting for a frame.
+ */
+#define GS_TIMEOUT_DELAYED 0
+#define GS_TIMEOUT_TAP 1
+#define GS_TIMEOUT_DRAG 2
+#define DIM_TIMEOUTS 3
+
+#define DIM_BUTTON_EVENTS 64
+
+struct ButtonEvent {
+	int button;
+	int down;
+};
+
 struct Gestures {
 	/* Taps, physical buttons, and gestures will trigger
 	 * button events. If a bit is set, the button is down.
@@ -49,18 +64,51 @@ struct Gestures {
 	 */
 	bitmask_t buttons;
 
+	/* Physical buttons down at the last frame, to see them change.
+	 */
+	bitmask_t hw_buttons;
+
+	/* Button transitions of the last frame, in the order they
+	 * happened. A click may go down and up within one frame.
+	 */
+	struct ButtonEvent button_events[DIM_BUTTON_EVENTS];
+	int button_count;
+
 	/* Pointer movement is tracked here.
 	 */
 	int move_dx, move_dy;
 
+	/* Smooth scrolling is tracked here, in touchpad units. Only
+	 * used when scroll_smooth is set.
+	 */
+	int scroll_dx, scroll_dy;
+
+	/* XI gestures are tracked here. Only used when gesture_events
+	 * is set. gesture_type is the gesture in progress and lasts as
+	 * long as its touch count. gesture_begin is set on its first
+	 * frame. gesture_ended is set for one frame when a gesture of
+	 * that type finishes, before any new one begins.
+	 */
+	int gesture_type;
+	int gesture_fingers;
+	int gesture_begin;
+	int gesture_ended;
+	int gesture_ended_fingers;
+	double gesture_dx, gesture_dy;
+	double gesture_scale;	/* relative to the start of a pinch */
+	double gesture_angle;	/* degrees clockwise since last frame */
+
 	/* Internal state tracking. Not for direct access.
 	 */
 	int button_emulate;
 	int button_delayed;
-	mstime_t button_delayed_time;
-	int button_delayed_ms;
 
-	mstime_t tap_time_down;
+	/* Pending deadlines, indexed by GS_TIMEOUT_*. A bit in
+	 * timeout_used is set while the deadline is armed.
+	 */
+	ustime_t timeout[DIM_TIMEOUTS];
+	bitmask_t timeout_used;
+
 	int tap_touching;
 	int tap_released;
 	int move_type;
@@ -69,19 +117,26 @@ struct Gestures {
 	int move_drag;
 	int move_drag_dx;
 	int move_drag_dy;
-	mstime_t move_wait;
-	mstime_t move_drag_wait;
-	mstime_t move_drag_expire;
+	ustime_t move_wait;
+	ustime_t move_drag_wait;
 };
 
 
 void gestures_init(struct Gestures* gs);
+
+/* Start over like gestures_init, but queue releases of the buttons
+ * still down and end the pinch or swipe in progress, so they can be
+ * posted like those of any frame.
+ */
+void gestures_reset(struct Gestures* gs);
 void gestures_extract(struct Gestures* gs,
 			const struct MConfig* cfg,
 			const struct HWState* hs,
 			struct MTState* ms);
-int gestures_delayed(struct Gestures* gs,
-			struct mtdev* dev, int fd);
+ustime_t gestures_deadline(const struct Gestures* gs);
+int gestures_expire(struct Gestures* gs,
+			struct MTState* ms,
+			ustime_t now);
 
 #endif
 
@@ -25,30 +25,71 @@
 #include "common.h"
 #include "capabilities.h"
 
+#define DIM_EVENTS 256
+
+/* Kinds of slot values, for the changed field masks. */
+#define HW_POSITION 0
+#define HW_SIZE 1
+#define HW_PRESSURE 2
+#define HW_ORIENTATION 3
+#define HW_TRACKING 4
+#define HW_BUTTON 5
+
 struct FingerState {
 	int touch_major, touch_minor;
 	int width_major, width_minor;
 	int orientation, pressure;
-	int position_x, position_y;
 	int tracking_id;
 };
 
+/* Events pulled from the device but not yet applied. The buffer is
+ * refilled in bursts once drained, so one read can serve several
+ * packets.
+ */
+struct EventBuffer {
+	struct input_event ev[DIM_EVENTS];
+	int head, tail;
+	__u64 reads;
+	__u64 events;
+};
+
+struct HWState;
+
+/* Packet completion specialized for the capabilities of one device.
+ */
+typedef void (*hwstate_finish_fn)(struct HWState *s,
+				  const struct input_event *syn);
+
 struct HWState {
+	hwstate_finish_fn finish;
+	struct EventBuffer buffer;
 	struct FingerState data[DIM_FINGER];
+	int position_x[DIM_FINGER], position_y[DIM_FINGER];
 	bitmask_t used;
-	bitmask_t slot;
+	int slot;
 	bitmask_t button;
-	mstime_t evtime;
+	ustime_t evtime;
 	int max_x, max_y;
+	int dropped;
+	int resync_failed;	/* failed resyncs, until taken for the log */
+
+	/* Slots with changed values, HW_* kinds of changed values and
+	 * slots with a changed position, for the last reported frame.
+	 * The dirty masks collect the same for the frame being read.
+	 */
+	bitmask_t changed_slots, changed_fields, moved_slots;
+	bitmask_t dirty_slots, dirty_fields, dirty_moved;
 };
 
 void hwstate_init(struct HWState *s,
 			const struct Capabilities *caps);
+int hwstate_sync(struct HWState *s,
+			const struct Capabilities *caps, int fd);
 int hwstate_modify(struct HWState *s,
 			struct mtdev *dev, int fd,
 			const struct Capabilities *caps);
+int hwstate_idle(const struct HWState *s,
+			struct mtdev *dev, int fd, int ms);
 void hwstate_output(const struct HWState *s);
 
-int find_finger(const struct HWState *s, int tracking_id);
-
 #endif
@@ -25,6 +25,8 @@
 #include "capabilities.h"
 
 #define DEFAULT_TRACKPAD_DISABLE 0
+#define DEFAULT_PASSTHROUGH 0
+#define DEFAULT_READER_THREAD 0
 #define DEFAULT_TOUCH_DOWN 5
 #define DEFAULT_TOUCH_UP 5
 #define DEFAULT_IGNORE_THUMB 0
@@ -50,11 +52,13 @@
 #define DEFAULT_TAP_DIST 400
 #define DEFAULT_GESTURE_HOLD 10
 #define DEFAULT_GESTURE_WAIT 100
+#define DEFAULT_GESTURE_EVENTS 1
 #define DEFAULT_SCROLL_DIST 150
 #define DEFAULT_SCROLL_UP_BTN 4
 #define DEFAULT_SCROLL_DN_BTN 5
 #define DEFAULT_SCROLL_LT_BTN 6
 #define DEFAULT_SCROLL_RT_BTN 7
+#define DEFAULT_SCROLL_SMOOTH 1
 #define DEFAULT_SWIPE_DIST 700
 #define DEFAULT_SWIPE_UP_BTN 8
 #define DEFAULT_SWIPE_DN_BTN 9
@@ -82,6 +86,22 @@
 #define MCFG_SIZE 2
 #define MCFG_PRESSURE 3
 
+/* Rows of the action table. Columns are the number of touches and the
+ * TR_DIR_* direction, which leaves room for diagonals.
+ */
+#define MCFG_ACTION_SCROLL 0
+#define MCFG_ACTION_SWIPE 1
+#define MCFG_ACTION_SCALE 2
+#define MCFG_ACTION_ROTATE 3
+#define DIM_ACTION_TYPES 4
+#define DIM_ACTION_TOUCHES 5
+#define DIM_ACTION_DIRS 8
+
+struct MAction {
+	int button;		// Button to click. >= 0, 0 is none
+	int dist;		// Distance needed to click it. >= 0, 0 disables
+};
+
 struct MConfig {
 	/* Used by MTState */
 
@@ -104,10 +124,18 @@ struct MConfig {
 	int thumb_size;		// Minimum touch size for a thumb. 0 - 100
 	int palm_size;		// Minimum touch size for a palm. 0 - 100
 
+	// Set by mconfig_compile from the above, in device units.
+	int touch_down_raw;	// Lowest touch value that is touching.
+	int touch_up_raw;	// Touch values below this are released.
+	int thumb_size_raw;	// Lowest touch size of a thumb.
+	int palm_size_raw;	// Lowest touch size of a palm.
+
 	/* Used by Gestures */
 
 	// Set by config.
 	int trackpad_disable;	// Disable the trackpad? 0 or 1
+	int passthrough;		// Post raw touches and skip gestures? 0 or 1
+	int reader_thread;		// Read and process input on a thread of our own? 0 or 1
 	int button_enable;		// Enable physical buttons? 0 or 1
 	int button_integrated;	// Is the button under the touchpad? 0 or 1
 	int button_expire;		// How long to consider a touch for button emulation. >= 0
@@ -127,11 +155,13 @@ struct MConfig {
 	int tap_dist;			// How far to allow a touch to move before it's a moving touch. > 0
 	int gesture_hold;		// How long to "hold down" the emulated button for gestures. > 0
 	int gesture_wait;		// How long after a gesture to wait before movement is allowed. >= 0
+	int gesture_events;		// Send swipes, scales and rotates as XI gestures instead of buttons? 0 or 1
 	int scroll_dist;		// Distance needed to trigger a button. >= 0, 0 disables
 	int scroll_up_btn;		// Button to use for scroll up. >= 0, 0 is none
 	int scroll_dn_btn;		// Button to use for scroll down. >= 0, 0 is none
 	int scroll_lt_btn;		// Button to use for scroll left. >= 0, 0 is none
 	int scroll_rt_btn;		// Button to use for scroll right. >= 0, 0 is none
+	int scroll_smooth;		// Scroll through valuators instead of wheel buttons? 0 or 1
 	int swipe_dist;			// Distance needed to trigger a button. >= 0, 0 disables
 	int swipe_up_btn;		// Button to use for swipe up. >= 0, 0 is none
 	int swipe_dn_btn;		// Button to use for swipe down. >= 0, 0 is none
@@ -153,6 +183,9 @@ struct MConfig {
 	int drag_wait;			// How long to wait before triggering button down? >= 0
 	int drag_dist;			// How far is the finger allowed to move during wait time? >= 0
 	double sensitivity;		// Mouse movement multiplier. >= 0
+
+	// Set by mconfig_compile from the button and distance settings.
+	struct MAction actions[DIM_ACTION_TYPES][DIM_ACTION_TOUCHES][DIM_ACTION_DIRS];
 };
 
 /* Load the MConfig struct with its defaults.
@@ -167,5 +200,10 @@ void mconfig_init(struct MConfig* cfg,
 void mconfig_configure(struct MConfig* cfg,
 			pointer opts);
 
+/* Recompute the device unit thresholds and the action table after
+ * any setting changed.
+ */
+void mconfig_compile(struct MConfig* cfg);
+
 #endif
 
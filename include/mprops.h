@@ -38,6 +38,8 @@
 
 // int, 1 value
 #define MTRACK_PROP_TRACKPAD_DISABLE "Trackpad Disable Input"
+// int, 1 value
+#define MTRACK_PROP_PASSTHROUGH "Trackpad Touch Passthrough"
 // float, 1 value
 #define MTRACK_PROP_SENSITIVITY "Trackpad Sensitivity"
 // int, 2 values - finger low, finger high
@@ -84,38 +86,36 @@
 // int, 4 values - enable, timeout, wait, dist
 #define MTRACK_PROP_DRAG_SETTINGS "Trackpad Drag Settings"
 
+// string - name of the preset last switched to, set to switch presets;
+// later changes to single properties leave it as it is
+#define MTRACK_PROP_PROFILE "Trackpad Profile"
+
+/* Entries in the property registry of mprops.c, and the size of the
+ * table hashing their atoms, a power of two over twice as large.
+ */
+#define DIM_PROPS 24
+#define DIM_PROP_HASH_BITS 6
+#define DIM_PROP_HASH (1 << DIM_PROP_HASH_BITS)
+
 struct MProps {
 	// Properties Config
 	Atom float_type;
 
-	// Adjustable Properties
-	Atom api;
-	Atom trackpad_disable;
-	Atom sensitivity;
-	Atom pressure;
-	Atom button_settings;
-	Atom button_emulate;
-	Atom tap_settings;
-	Atom tap_emulate;
-	Atom thumb_detect;
-	Atom thumb_size;
-	Atom palm_detect;
-	Atom palm_size;
-	Atom gesture_settings;
-	Atom scroll_dist;
-	Atom scroll_buttons;
-	Atom swipe_dist;
-	Atom swipe_buttons;
-	Atom swipe4_dist;
-	Atom swipe4_buttons;
-	Atom scale_dist;
-	Atom scale_buttons;
-	Atom rotate_dist;
-	Atom rotate_buttons;
-	Atom drag_settings;
+	// Adjustable Properties, indexed like the registry
+	Atom atom[DIM_PROPS];
+	Atom profile;
+
+	// Registry index + 1 by atom hash, 0 for none
+	unsigned char hash[DIM_PROP_HASH];
+
+	// Config as the options left it, the base of every profile
+	struct MConfig base;
+
+	// Set while pushing profile values out to the properties
+	int updating;
 };
 
-void mprops_init(struct MConfig* cfg, InputInfoPtr local);
+void mprops_init(struct MProps* mp, const struct MConfig* cfg, InputInfoPtr local);
 int mprops_set_property(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop, BOOL checkonly);
 
 #endif
@@ -29,21 +29,77 @@
 #include "mtstate.h"
 #include "mconfig.h"
 #include "gestures.h"
+#include "mprops.h"
+#include <time.h>
+
+struct Reader;
+
+/* Problems processing ran into, counted until they are logged. The
+ * log is only safe on the main thread, a reader thread hands them
+ * over with its frames.
+ */
+struct MWarnings {
+	int resync_failed;
+	int touches_ignored;
+};
 
 struct MTouch {
-	struct mtdev dev;
+	struct mtdev *dev;	/* only for devices without slots */
 	struct Capabilities caps;
 	struct HWState hs;
 	struct MTState state;
-	struct MConfig cfg;
+	struct MConfig cfg;	/* settings, changed by options and properties only */
 	struct Gestures gs;
+	clockid_t clock;	/* clock of the event timestamps */
+	bitmask_t frame_fields;	/* HW_* kinds the touch tracking reads */
+	OsTimerPtr timer;	/* next gesture deadline, driver only */
+	struct MProps props;	/* property atoms and profile base, driver only */
+#if defined(HAVE_SMOOTH_SCROLL) || defined(HAVE_TOUCH_EVENTS)
+	ValuatorMask *valuators;	/* driver only */
+#endif
+
+	/* Passthrough mode in effect; follows cfg.passthrough between
+	 * reads. The slots posted as touches and their ids are kept
+	 * here.
+	 */
+	int passthrough;
+	bitmask_t passthrough_used;
+	int passthrough_id[DIM_FINGER];
+
+	/* Reader thread, if input is read and processed on one. */
+	struct Reader *reader;
+
+	/* Compiled copies of cfg, one each for the side that changes cfg
+	 * (back), for processing (front) and for handing over between
+	 * them (middle, marked CFG_FRESH until taken). Packets read the
+	 * front copy through cfg_live only, which moves to a fresh
+	 * middle copy between packets.
+	 */
+	struct MConfig cfg_copy[3];
+	int cfg_back, cfg_front;
+	int cfg_middle;
+	const struct MConfig *cfg_live;
 };
 
 int mtouch_configure(struct MTouch *mt, int fd);
 int mtouch_open(struct MTouch *mt, int fd);
 int mtouch_close(struct MTouch *mt, int fd);
 
+/* Compile cfg and have packets use it from the next one on. Only for
+ * the thread that changes cfg, and lock free against processing.
+ */
+void mtouch_publish_config(struct MTouch *mt);
+
+int mtouch_update_mode(struct MTouch *mt);
 int read_packet(struct MTouch *mt, int fd);
-int has_delayed(struct MTouch *mt, int fd);
+ustime_t mtouch_time(const struct MTouch *mt);
+int mtouch_timeout(const struct MTouch *mt);
+int read_timeouts(struct MTouch *mt, int fd);
+
+/* Move the problems counted so far into w, only on the thread that
+ * processes packets. Log them on the main thread.
+ */
+void mtouch_take_warnings(struct MTouch *mt, struct MWarnings *w);
+void mtouch_log_warnings(const struct MWarnings *w);
 
 #endif
@@ -27,32 +27,92 @@
 #include "mconfig.h"
 #include "hwstate.h"
 
-#define MT_NEW 0
-#define MT_RELEASED 1
-#define MT_INVALID 2
 #define MT_THUMB 3
 #define MT_PALM 4
 
+/* Per-touch metadata. Positions and deltas, which every frame
+ * touches, live in the arrays of MTState instead, and so does the
+ * class of each touch.
+ */
 struct Touch {
-	bitmask_t state;
-	bitmask_t flags;
-	mstime_t down;
-	double direction;
+	ustime_t down;
+	int direction;
 	int tracking_id;
-	int x, y, dx, dy;
-	int total_dx, total_dy;
 };
 
+struct MTState;
+
+/* Touch tracking specialized for the capabilities of one device.
+ */
+typedef void (*mtstate_update_fn)(struct MTState* ms,
+			const struct MConfig* cfg,
+			const struct HWState* hs);
+
 struct MTState {
+	mtstate_update_fn update;
 	bitmask_t state;
-	mstime_t evtime;
+	ustime_t evtime;
+
+	/* Position, position at the last frame, last movement and
+	 * movement since touch down of each touch, indexed like touch[].
+	 * Entries of unused touches are stale.
+	 */
+	int x[DIM_TOUCHES], y[DIM_TOUCHES];
+	int last_x[DIM_TOUCHES], last_y[DIM_TOUCHES];
+	int dx[DIM_TOUCHES], dy[DIM_TOUCHES];
+	int total_dx[DIM_TOUCHES], total_dy[DIM_TOUCHES];
+
 	struct Touch touch[DIM_TOUCHES];
 	bitmask_t touch_used;
+
+	/* Touch classes, each a subset of touch_used. They change only
+	 * when a touch does: touches are new for the frame they appear
+	 * in and released for the frame they are lifted in. Touches in
+	 * none of invalid, button and tap are free to gesture with.
+	 */
+	bitmask_t touch_new;
+	bitmask_t touch_released;
+	bitmask_t touch_invalid;
+	bitmask_t touch_thumb;
+	bitmask_t touch_palm;
+
+	/* Classes owned by gestures: touches resting on the button and
+	 * touches that may still become a tap.
+	 */
+	bitmask_t touch_button;
+	bitmask_t touch_tap;
+
+	/* Touch tracked for each hardware slot, valid where the bit in
+	 * slot_used is set.
+	 */
+	int slot_touch[DIM_FINGER];
+	bitmask_t slot_used;
+
+	/* The last frame left all touches at rest: none appeared, moved
+	 * or was released. Until the hardware changes, further frames
+	 * would leave everything as it is.
+	 */
+	int settled;
+
+	/* Touches ignored for lack of room, until taken for the log. */
+	int touches_ignored;
+
+	/* Touches that moved in the last frame and whose direction is
+	 * not computed yet. Read directions through mtstate_direction.
+	 */
+	bitmask_t direction_stale;
 };
 
-/* Initialize an MTState struct.
+/* Initialize an MTState struct and pick the touch tracking for the
+ * touch type of the config.
+ */
+void mtstate_init(struct MTState* ms,
+			const struct MConfig* cfg);
+
+/* Direction of the last movement of a touch, TR_ANGLE_NONE if it did
+ * not move. Computed on first use in each frame.
  */
-void mtstate_init(struct MTState* ms);
+int mtstate_direction(struct MTState* ms, int touch);
 
 /* Extract the MTState from the current hardware state.
  */
@@ -0,0 +1,99 @@
+/***************************************************************************
+ *
+ * Multitouch X driver
+ * Copyright (C) 2008 Henrik Rydberg <rydberg@euromail.se>
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef READER_H
+#define READER_H
+
+#include "mtouch.h"
+#include <pthread.h>
+
+/* Frames the reader can be ahead of the main thread, a power of two.
+ */
+#define DIM_FRAMES 64
+
+/* The slots of one packet, as passthrough posts them.
+ */
+struct SlotFrame {
+	bitmask_t used, moved;
+	int tracking_id[DIM_FINGER];
+	int x[DIM_FINGER], y[DIM_FINGER];
+};
+
+/* The output of one packet, or of gesture deadlines that expired.
+ * Passthrough frames carry slots, the others gestures.
+ */
+struct ReaderFrame {
+	ustime_t evtime;	/* event time of the packet, or 0 */
+	ustime_t ready;		/* when the reader was done with it */
+	int passthrough;
+	struct SlotFrame slots;
+	struct Gestures gs;
+	struct MWarnings warn;	/* for the main thread to log */
+};
+
+/* Single producer, single consumer queue of frames. Only the reader
+ * thread moves head and only the main thread moves tail, so neither
+ * side needs a lock.
+ */
+struct FrameRing {
+	struct ReaderFrame frame[DIM_FRAMES];
+	unsigned head __attribute__((aligned(64)));
+	unsigned tail __attribute__((aligned(64)));
+};
+
+struct Reader {
+	struct FrameRing ring;
+	struct MTouch *mt;
+	pthread_t thread;
+	int fd;			/* the device */
+	int epfd;
+	int wake[2];		/* a byte per frame, to the main thread */
+	int quit[2];		/* tells the reader to stop */
+	int stopping;
+	int failed;		/* the reader stopped on its own */
+	int error;		/* errno it stopped on, once failed */
+};
+
+/* Copy the slots of the last packet.
+ */
+void slotframe_extract(struct SlotFrame *sf, const struct HWState *hs);
+
+/* Start reading and processing the opened device on a thread of its
+ * own. Returns the fd that becomes readable when frames are queued,
+ * or a negative error.
+ */
+int reader_start(struct MTouch *mt, int fd);
+void reader_stop(struct MTouch *mt);
+
+/* Take the queued frames in order. Only for the main thread. Call
+ * reader_drain first, once it is woken up.
+ */
+void reader_drain(struct Reader *r);
+const struct ReaderFrame *reader_peek(struct Reader *r);
+void reader_pop(struct Reader *r);
+
+/* The errno the reader thread stopped on, once it did and all its
+ * frames are taken, 0 otherwise. The reader can only be stopped then.
+ */
+int reader_error(struct Reader *r);
+
+#endif
@@ -33,45 +33,55 @@
 #define TR_DIR_DN 4
 #define TR_DIR_LT 6
 
+/* Angles are binary fractions of a circle, TR_TURN to the turn, so
+ * they wrap by masking. TR_ANGLE converts a count of 45 degree steps,
+ * like the TR_DIR_* values, into an angle.
+ */
+#define TR_TURN 0x10000
+#define TR_MASK (TR_TURN - 1)
+#define TR_ANGLE(n) ((n) * (TR_TURN / 8))
+
+/* Direction of a vector of zero magnitude. */
+#define TR_ANGLE_NONE TR_ANGLE(TR_NONE)
+
 /* Determine in which quadrant a point lies. Counts from 0. Returns
  * TR_NONE if the point lies at the origin.
  */
-int trig_quadrant(double x, double y);
+int trig_quadrant(int x, int y);
 
 /* Determine the direction of a vector. This uses the slope of the
  * vector to approximate the angle, as such it is only accurate at
  * increments of 45 degrees. This is sufficient for our uses.
  *
- * The returned value is 0 <= a < 8 such that the circle is split
- * into 45 degree sections. Each whole number lies 45 degrees apart
- * and so whole numbers are exact. All fractional parts are
- * aproximations.
+ * The returned value is 0 <= a < TR_TURN, each TR_ANGLE(1) step is
+ * exactly 45 degrees and the angles between are approximations.
  *
- * TR_NONE will be returned if the magnitude of the vector is zero.
+ * TR_ANGLE_NONE will be returned if the magnitude of the vector is
+ * zero.
  */
-double trig_direction(double dx, double dy);
+int trig_direction(int dx, int dy);
 
 /* Generalize a direction.  Returns TR_NONE, TR_DIR_UP, TR_DIR_RT,
  * TR_DIR_DN, or TR_DIR_LT.
  */
-int trig_generalize(double dir);
+int trig_generalize(int dir);
 
 /* Add two angles.
  */
-double trig_angles_add(double a1, double a2);
+int trig_angles_add(int a1, int a2);
 
 /* Subtract two angles.
  */
-double trig_angles_sub(double a1, double a2);
+int trig_angles_sub(int a1, int a2);
 
 /* Calculate the acute angle between two angles.
  */
-double trig_angles_acute(double a1, double a2);
+int trig_angles_acute(int a1, int a2);
 
 /* Compare two angles. Returns 0 if a1 == a2. Returns < 0 if a1 < a2.
  * Returns > 0 if a1 > a2.
  */
-int trig_angles_cmp(double a1, double a2);
+int trig_angles_cmp(int a1, int a2);
 
 #endif
 
@@ -26,11 +26,55 @@
  **************************************************************************/
 
 #include "gestures.h"
+#include "button.h"
 #include "trig.h"
+#include <math.h>
 #include <poll.h>
 
 #define IS_VALID_BUTTON(x) (x >= 0 && x <= 31)
 
+static void timeout_set(struct Gestures* gs, int id, ustime_t deadline)
+{
+	gs->timeout[id] = deadline;
+	SETBIT(gs->timeout_used, id);
+}
+
+static void timeout_clear(struct Gestures* gs, int id)
+{
+	CLEARBIT(gs->timeout_used, id);
+}
+
+static int timeout_pending(const struct Gestures* gs, int id)
+{
+	return GETBIT(gs->timeout_used, id);
+}
+
+static int timeout_expired(const struct Gestures* gs, int id, ustime_t now)
+{
+	return GETBIT(gs->timeout_used, id) && now >= gs->timeout[id];
+}
+
+/* Change a button and queue the transition. Returns 0 if the queue is
+ * full, in which case the button is left alone.
+ */
+static int button_set(struct Gestures* gs, int button, int down)
+{
+	struct ButtonEvent *ev;
+	if (GETBIT(gs->buttons, button) == down)
+		return 1;
+	if (gs->button_count >= DIM_BUTTON_EVENTS) {
+#ifdef DEBUG_GESTURES
+		xf86Msg(X_INFO, "button_set: queue full, %d %s dropped\n", button, down ? "down" : "up");
+#endif
+		return 0;
+	}
+	ev = &gs->button_events[gs->button_count++];
+	ev->button = button;
+	ev->down = down;
+	MODBIT(gs->buttons, button, down);
+	return 1;
+}
+
 static void trigger_button_up(struct Gestures* gs, int button)
 {
 	if (IS_VALID_BUTTON(button)) {
@@ -38,7 +82,7 @@ static void trigger_button_up(struct Gestures* gs, int button)
 			button = gs->button_emulate;
 			gs->button_emulate = 0;
 		}
-		CLEARBIT(gs->buttons, button);
+		button_set(gs, button, 0);
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "trigger_button_up: %d up\n", button);
 #endif
@@ -47,8 +91,8 @@ static void trigger_button_up(struct Gestures* gs, int button)
 
 static void trigger_button_down(struct Gestures* gs, int button)
 {
-	if (IS_VALID_BUTTON(button) && (button != gs->button_delayed || gs->button_delayed_time == 0)) {
-		SETBIT(gs->buttons, button);
+	if (IS_VALID_BUTTON(button) && (button != gs->button_delayed || !timeout_pending(gs, GS_TIMEOUT_DELAYED))) {
+		button_set(gs, button, 1);
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "trigger_button_down: %d down\n", button);
 #endif
@@ -61,9 +105,22 @@ static void trigger_button_down(struct Gestures* gs, int button)
 
 static void trigger_button_emulation(struct Gestures* gs, int button)
 {
+	int i;
 	if (IS_VALID_BUTTON(button) && GETBIT(gs->buttons, 0)) {
-		CLEARBIT(gs->buttons, 0);
-		SETBIT(gs->buttons, button);
+		for (i = gs->button_count - 1; i >= 0; i--) {
+			if (gs->button_events[i].button == 0 && gs->button_events[i].down)
+				break;
+		}
+		if (i >= 0 && !GETBIT(gs->buttons, button)) {
+			/* rewrite the queued press rather than sending two */
+			gs->button_events[i].button = button;
+			CLEARBIT(gs->buttons, 0);
+			SETBIT(gs->buttons, button);
+		}
+		else {
+			button_set(gs, 0, 0);
+			button_set(gs, button, 1);
+		}
 		gs->button_emulate = button;
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "trigger_button_emulation: %d emulated\n", button);
@@ -71,22 +128,42 @@ static void trigger_button_emulation(struct Gestures* gs, int button)
 	}
 }
 
+static void delayed_release(struct Gestures* gs)
+{
+	trigger_button_up(gs, gs->button_delayed);
+	timeout_clear(gs, GS_TIMEOUT_DELAYED);
+	gs->button_delayed = 0;
+}
+
 static void trigger_button_click(struct Gestures* gs,
-			int button, mstime_t trigger_up_time)
+			int button, ustime_t trigger_up_time)
 {
-	if (IS_VALID_BUTTON(button) && gs->button_delayed_time == 0) {
+	if (IS_VALID_BUTTON(button)) {
+		if (timeout_pending(gs, GS_TIMEOUT_DELAYED)) {
+#ifdef DEBUG_GESTURES
+			xf86Msg(X_INFO, "trigger_button_click: %d released early\n", gs->button_delayed);
+#endif
+			delayed_release(gs);
+		}
 		trigger_button_down(gs, button);
 		gs->button_delayed = button;
-		gs->button_delayed_ms = 0;
-		gs->button_delayed_time = trigger_up_time;
-#ifdef DEBUG_GESTRUES
-		xf86Msg(X_INFO, "trigger_button_click: %d placed in delayed mode\n");
-#endif
-	}
+		timeout_set(gs, GS_TIMEOUT_DELAYED, trigger_up_time);
 #ifdef DEBUG_GESTURES
-	else if (IS_VALID_BUTTON(button))
-		xf86Msg(X_INFO, "trigger_button_click: %d ignored, in delayed mode\n", button);
+		xf86Msg(X_INFO, "trigger_button_click: %d placed in delayed mode\n", button);
 #endif
+	}
+}
+
+/* Click once for every dist units travelled. Whatever does not fit in
+ * the event queue stays in move_dist for the next frame.
+ */
+static void trigger_button_clicks(struct Gestures* gs,
+			int button, int dist, ustime_t trigger_up_time)
+{
+	while (dist > 0 && gs->move_dist >= dist && gs->button_count + 2 <= DIM_BUTTON_EVENTS) {
+		gs->move_dist -= dist;
+		trigger_button_click(gs, button, trigger_up_time);
+	}
 }
 
 static void trigger_drag_ready(struct Gestures* gs,
@@ -94,7 +171,7 @@ static void trigger_drag_ready(struct Gestures* gs,
 			const struct HWState* hs)
 {
 	gs->move_drag = GS_DRAG_READY;
-	gs->move_drag_expire = hs->evtime + cfg->drag_timeout;
+	timeout_set(gs, GS_TIMEOUT_DRAG, hs->evtime + MS2US(cfg->drag_timeout));
 #ifdef DEBUG_GESTURES
 	xf86Msg(X_INFO, "trigger_drag_ready: drag is ready\n");
 #endif
@@ -106,7 +183,7 @@ static int trigger_drag_start(struct Gestures* gs,
 			int dx, int dy)
 {
 	if (gs->move_drag == GS_DRAG_READY) {
-		gs->move_drag_expire = 0;
+		timeout_clear(gs, GS_TIMEOUT_DRAG);
 		if (cfg->drag_wait == 0) {
  			gs->move_drag = GS_DRAG_ACTIVE;
 			trigger_button_down(gs, 0);
@@ -116,7 +193,7 @@ static int trigger_drag_start(struct Gestures* gs,
 		}
 		else {
 			gs->move_drag = GS_DRAG_WAIT;
-			gs->move_drag_wait = hs->evtime + cfg->drag_wait;
+			gs->move_drag_wait = hs->evtime + MS2US(cfg->drag_wait);
 			gs->move_drag_dx = dx;
 			gs->move_drag_dy = dy;
 #ifdef DEBUG_GESTURES
@@ -148,14 +225,14 @@ static void trigger_drag_stop(struct Gestures* gs, int force)
 {
 	if (gs->move_drag == GS_DRAG_READY && force) {
 		gs->move_drag = GS_NONE;
-		gs->move_drag_expire = 0;
+		timeout_clear(gs, GS_TIMEOUT_DRAG);
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "trigger_drag_stop: drag canceled\n");
 #endif
 	}
 	else if (gs->move_drag == GS_DRAG_ACTIVE) {
 		gs->move_drag = GS_NONE;
-		gs->move_drag_expire = 0;
+		timeout_clear(gs, GS_TIMEOUT_DRAG);
 		trigger_button_up(gs, 0);
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "trigger_drag_stop: drag stopped\n");
@@ -171,13 +248,12 @@ static void buttons_update(struct Gestures* gs,
 	if (!cfg->button_enable || cfg->trackpad_disable >= 3)
 		return;
 
-	static bitmask_t button_prev = 0U;
 	int i, down, emulate, touching;
 	down = 0;
-	emulate = GETBIT(hs->button, 0) && !GETBIT(button_prev, 0);
+	emulate = GETBIT(hs->button, 0) && !GETBIT(gs->hw_buttons, 0);
 
 	for (i = 0; i < 32; i++) {
-		if (GETBIT(hs->button, i) == GETBIT(button_prev, i))
+		if (GETBIT(hs->button, i) == GETBIT(gs->hw_buttons, i))
 			continue;
 		if (GETBIT(hs->button, i)) {
 			down++;
@@ -186,19 +262,18 @@ static void buttons_update(struct Gestures* gs,
 		else
 			trigger_button_up(gs, i);
 	}
-	button_prev = hs->button;
+	gs->hw_buttons = hs->button;
 
 	if (down) {
 		int earliest, latest;
 		gs->move_type = GS_NONE;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
+		gs->move_wait = hs->evtime + MS2US(cfg->gesture_wait);
+		bitmask_t valid = ms->touch_used & ~ms->touch_invalid;
 		earliest = -1;
 		latest = -1;
-		foreach_bit(i, ms->touch_used) {
-			if (GETBIT(ms->touch[i].state, MT_INVALID))
-				continue;
-			if (cfg->button_integrated && !GETBIT(ms->touch[i].flags, GS_BUTTON))
-				SETBIT(ms->touch[i].flags, GS_BUTTON);
+		if (cfg->button_integrated)
+			ms->touch_button |= valid;
+		foreach_bit(i, valid) {
 			if (earliest == -1 || ms->touch[i].down < ms->touch[earliest].down)
 				earliest = i;
 			if (latest == -1 || ms->touch[i].down > ms->touch[latest].down)
@@ -220,7 +295,7 @@ static void buttons_update(struct Gestures* gs,
 
 				if (zones > 0) {
 					width = ((double)cfg->pad_width)/((double)zones);
-					pos = cfg->pad_width / 2 + ms->touch[earliest].x;
+					pos = cfg->pad_width / 2 + ms->x[earliest];
 #ifdef DEBUG_GESTURES
 					xf86Msg(X_INFO, "buttons_update: pad width %d, zones %d, zone width %f, x %d\n",
 						cfg->pad_width, zones, width, pos);
@@ -251,7 +326,7 @@ static void buttons_update(struct Gestures* gs,
 			else if (latest >= 0) {
 				touching = 0;
 				foreach_bit(i, ms->touch_used) {
-					if (cfg->button_expire == 0 || ms->touch[latest].down < ms->touch[i].down + cfg->button_expire)
+					if (cfg->button_expire == 0 || ms->touch[latest].down < ms->touch[i].down + MS2US(cfg->button_expire))
 						touching++;
 				}
 
@@ -269,6 +344,15 @@ static void buttons_update(struct Gestures* gs,
 	}
 }
 
+static void tapping_reset(struct Gestures* gs,
+			struct MTState* ms)
+{
+	timeout_clear(gs, GS_TIMEOUT_TAP);
+	gs->tap_touching = 0;
+	gs->tap_released = 0;
+	ms->touch_tap = 0;
+}
+
 static void tapping_update(struct Gestures* gs,
 			const struct MConfig* cfg,
 			const struct HWState* hs,
@@ -290,64 +374,59 @@ static void tapping_update(struct Gestures* gs,
 	else
 		return;
 
-	if (gs->tap_time_down != 0 && hs->evtime >= gs->tap_time_down + cfg->tap_timeout) {
-		gs->tap_time_down = 0;
-		gs->tap_touching = 0;
-		gs->tap_released = 0;
-		foreach_bit(i, ms->touch_used) {
-			if (GETBIT(ms->touch[i].flags, GS_TAP))
-				CLEARBIT(ms->touch[i].flags, GS_TAP);
-		}
-	}
+	if (timeout_expired(gs, GS_TIMEOUT_TAP, hs->evtime))
+		tapping_reset(gs, ms);
 	else {
-		foreach_bit(i, ms->touch_used) {
-			if (GETBIT(ms->touch[i].state, MT_INVALID) || GETBIT(ms->touch[i].flags, GS_BUTTON)) {
-				if (GETBIT(ms->touch[i].flags, GS_TAP)) {
-					CLEARBIT(ms->touch[i].flags, GS_TAP);
-					gs->tap_touching--;
+		bitmask_t lost, fresh, far, up;
+
+		// Invalid and button touches can no longer tap.
+		lost = ms->touch_tap & (ms->touch_invalid | ms->touch_button);
+		if (lost) {
+			ms->touch_tap &= ~lost;
+			gs->tap_touching -= bitcount(lost);
 #ifdef DEBUG_GESTURES
-					xf86Msg(X_INFO, "tapping_update: tap_touching-- (%d): invalid or button\n", gs->tap_touching);
+			xf86Msg(X_INFO, "tapping_update: tap_touching-%d (%d): invalid or button\n", bitcount(lost), gs->tap_touching);
 #endif
-				}
-			}
-			else {
-				if (GETBIT(ms->touch[i].state, MT_NEW)) {
-					SETBIT(ms->touch[i].flags, GS_TAP);
-					gs->tap_touching++;
+		}
+
+		fresh = ms->touch_new & ~(ms->touch_invalid | ms->touch_button);
+		if (fresh) {
+			ms->touch_tap |= fresh;
+			gs->tap_touching += bitcount(fresh);
 #ifdef DEBUG_GESTURES
-					xf86Msg(X_INFO, "tapping_update: tap_touching++ (%d): new touch\n", gs->tap_touching);
+			xf86Msg(X_INFO, "tapping_update: tap_touching+%d (%d): new touch\n", bitcount(fresh), gs->tap_touching);
 #endif
-					if (gs->tap_time_down == 0)
-						gs->tap_time_down = hs->evtime;
-				}
+			if (!timeout_pending(gs, GS_TIMEOUT_TAP))
+				timeout_set(gs, GS_TIMEOUT_TAP, hs->evtime + MS2US(cfg->tap_timeout));
+		}
 
-				if (GETBIT(ms->touch[i].flags, GS_TAP)) {
-					dist = dist2(ms->touch[i].total_dx, ms->touch[i].total_dy);
-					if (dist >= SQRVAL(cfg->tap_dist)) {
-						CLEARBIT(ms->touch[i].flags, GS_TAP);
-						gs->tap_touching--;
+		far = 0;
+		foreach_bit(i, ms->touch_tap) {
+			dist = dist2(ms->total_dx[i], ms->total_dy[i]);
+			if (dist >= SQRVAL(cfg->tap_dist))
+				SETBIT(far, i);
+		}
+		if (far) {
+			ms->touch_tap &= ~far;
+			gs->tap_touching -= bitcount(far);
 #ifdef DEBUG_GESTURES
-					xf86Msg(X_INFO, "tapping_update: tap_touching-- (%d): moved too far\n", gs->tap_touching);
+			xf86Msg(X_INFO, "tapping_update: tap_touching-%d (%d): moved too far\n", bitcount(far), gs->tap_touching);
 #endif
-					}
-					else if (GETBIT(ms->touch[i].state, MT_RELEASED)) {
-						gs->tap_touching--;
-						gs->tap_released++;
+		}
+
+		up = ms->touch_tap & ms->touch_released;
+		if (up) {
+			gs->tap_touching -= bitcount(up);
+			gs->tap_released += bitcount(up);
 #ifdef DEBUG_GESTURES
-					xf86Msg(X_INFO, "tapping_update: tap_touching-- (%d): released\n", gs->tap_touching);
-					xf86Msg(X_INFO, "tapping_update: tap_released++ (%d) (max %d): released\n", gs->tap_released, released_max);
+			xf86Msg(X_INFO, "tapping_update: tap_touching-%d (%d): released\n", bitcount(up), gs->tap_touching);
+			xf86Msg(X_INFO, "tapping_update: tap_released+%d (%d) (max %d): released\n", bitcount(up), gs->tap_released, released_max);
 #endif
-					}
-				}
-			}
 		}
 	}
 
 	if ((gs->tap_touching == 0 && gs->tap_released > 0) || gs->tap_released >= released_max) {
-		foreach_bit(i, ms->touch_used) {
-			if (GETBIT(ms->touch[i].flags, GS_TAP))
-				CLEARBIT(ms->touch[i].flags, GS_TAP);
-		}
+		ms->touch_tap = 0;
 
 		if (gs->tap_released == 1)
 			n = cfg->tap_1touch - 1;
@@ -358,14 +437,14 @@ static void tapping_update(struct Gestures* gs,
 		else
 			n = cfg->tap_4touch - 1;
 
-		trigger_button_click(gs, n, hs->evtime + cfg->tap_hold);
+		trigger_button_click(gs, n, hs->evtime + MS2US(cfg->tap_hold));
 		if (cfg->drag_enable && n == 0)
 			trigger_drag_ready(gs, cfg, hs);
 
 		gs->move_type = GS_NONE;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
+		gs->move_wait = hs->evtime + MS2US(cfg->gesture_wait);
 
-		gs->tap_time_down = 0;
+		timeout_clear(gs, GS_TIMEOUT_TAP);
 		gs->tap_touching = 0;
 		gs->tap_released = 0;
 	}
@@ -391,186 +470,202 @@ static void trigger_move(struct Gestures* gs,
 	}
 }
 
-static void trigger_scroll(struct Gestures* gs,
-			const struct MConfig* cfg,
-			const struct HWState* hs,
-			int dist, int dir)
+/* Scroll along the axis of the wheel button the scroll would click,
+ * so remapped buttons keep working. Returns 0 if the button is not a
+ * wheel button.
+ */
+static int trigger_smooth_scroll(struct Gestures* gs, int button, int dist)
 {
-	if (gs->move_type == GS_SCROLL || hs->evtime >= gs->move_wait) {
-		trigger_drag_stop(gs, 1);
-		if (gs->move_type != GS_SCROLL || gs->move_dir != dir)
-			gs->move_dist = 0;
-		gs->move_dx = 0;
-		gs->move_dy = 0;
-		gs->move_type = GS_SCROLL;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
-		gs->move_dist += ABSVAL(dist);
-		gs->move_dir = dir;
-		if (gs->move_dist >= cfg->scroll_dist) {
-			gs->move_dist = MODVAL(gs->move_dist, cfg->scroll_dist);
-			if (dir == TR_DIR_UP)
-				trigger_button_click(gs, cfg->scroll_up_btn - 1, hs->evtime + cfg->gesture_hold);
-			else if (dir == TR_DIR_DN)
-				trigger_button_click(gs, cfg->scroll_dn_btn - 1, hs->evtime + cfg->gesture_hold);
-			else if (dir == TR_DIR_LT)
-				trigger_button_click(gs, cfg->scroll_lt_btn - 1, hs->evtime + cfg->gesture_hold);
-			else if (dir == TR_DIR_RT)
-				trigger_button_click(gs, cfg->scroll_rt_btn - 1, hs->evtime + cfg->gesture_hold);
-		}
-#ifdef DEBUG_GESTURES
-		xf86Msg(X_INFO, "trigger_scroll: scrolling %+d in direction %d (at %d of %d)\n", dist, dir, gs->move_dist, cfg->scroll_dist);
-#endif
+	dist = ABSVAL(dist);
+	switch (button) {
+	case MT_BUTTON_WHEEL_UP:
+		gs->scroll_dy -= dist;
+		break;
+	case MT_BUTTON_WHEEL_DOWN:
+		gs->scroll_dy += dist;
+		break;
+	case MT_BUTTON_HWHEEL_LEFT:
+		gs->scroll_dx -= dist;
+		break;
+	case MT_BUTTON_HWHEEL_RIGHT:
+		gs->scroll_dx += dist;
+		break;
+	default:
+		return 0;
 	}
+	return 1;
 }
 
-static void trigger_swipe(struct Gestures* gs,
+/* Move type of each row of the action table.
+ */
+static const int action_move_type[DIM_ACTION_TYPES] = {
+	GS_SCROLL, GS_SWIPE, GS_SCALE, GS_ROTATE,
+};
+
+/* Follow a scroll, swipe, scale or rotate and click the buttons the
+ * action table holds for it.
+ */
+static void trigger_action(struct Gestures* gs,
 			const struct MConfig* cfg,
 			const struct HWState* hs,
-			int dist, int dir, int isfour)
+			int type, int touches, int dist, int dir)
 {
-	if (gs->move_type == GS_SWIPE || hs->evtime >= gs->move_wait) {
+	const struct MAction* action = &cfg->actions[type][touches][dir];
+	int move_type = action_move_type[type];
+	if (gs->move_type == move_type || hs->evtime >= gs->move_wait) {
 		trigger_drag_stop(gs, 1);
-		if (gs->move_type != GS_SWIPE || gs->move_dir != dir)
+		if (gs->move_type != move_type || gs->move_dir != dir)
 			gs->move_dist = 0;
 		gs->move_dx = 0;
 		gs->move_dy = 0;
-		gs->move_type = GS_SWIPE;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
+		gs->move_type = move_type;
+		gs->move_wait = hs->evtime + MS2US(cfg->gesture_wait);
 		gs->move_dist += ABSVAL(dist);
 		gs->move_dir = dir;
-		if (isfour) {
-			if (cfg->swipe4_dist > 0 && gs->move_dist >= cfg->swipe4_dist) {
-				gs->move_dist = MODVAL(gs->move_dist, cfg->swipe4_dist);
-				if (dir == TR_DIR_UP)
-					trigger_button_click(gs, cfg->swipe4_up_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_DN)
-					trigger_button_click(gs, cfg->swipe4_dn_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_LT)
-					trigger_button_click(gs, cfg->swipe4_lt_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_RT)
-					trigger_button_click(gs, cfg->swipe4_rt_btn - 1, hs->evtime + cfg->gesture_hold);
-			}
-#ifdef DEBUG_GESTURES
-			xf86Msg(X_INFO, "trigger_swipe4: swiping %+d in direction %d (at %d of %d)\n", dist, dir, gs->move_dist, cfg->swipe_dist);
-#endif
+		if (type == MCFG_ACTION_SCROLL) {
+			if (cfg->scroll_smooth && trigger_smooth_scroll(gs, action->button - 1, dist))
+				gs->move_dist = 0;
+			else
+				trigger_button_clicks(gs, action->button - 1, action->dist, hs->evtime + MS2US(cfg->gesture_hold));
 		}
-		else {
-			if (cfg->swipe_dist > 0 && gs->move_dist >= cfg->swipe_dist) {
-				gs->move_dist = MODVAL(gs->move_dist, cfg->swipe_dist);
-				if (dir == TR_DIR_UP)
-					trigger_button_click(gs, cfg->swipe_up_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_DN)
-					trigger_button_click(gs, cfg->swipe_dn_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_LT)
-					trigger_button_click(gs, cfg->swipe_lt_btn - 1, hs->evtime + cfg->gesture_hold);
-				else if (dir == TR_DIR_RT)
-					trigger_button_click(gs, cfg->swipe_rt_btn - 1, hs->evtime + cfg->gesture_hold);
-			}
+		else if (cfg->gesture_events)
+			gs->move_dist = 0;
+		else
+			trigger_button_clicks(gs, action->button - 1, action->dist, hs->evtime + MS2US(cfg->gesture_hold));
 #ifdef DEBUG_GESTURES
-			xf86Msg(X_INFO, "trigger_swipe: swiping %+d in direction %d (at %d of %d)\n", dist, dir, gs->move_dist, cfg->swipe_dist);
+		xf86Msg(X_INFO, "trigger_action: action %d with %d touches moving %+d in direction %d (at %d of %d)\n",
+			type, touches, dist, dir, gs->move_dist, action->dist);
 #endif
-		}
 	}
 }
 
-static void trigger_scale(struct Gestures* gs,
-			const struct MConfig* cfg,
-			const struct HWState* hs,
-			int dist, int dir)
+static void trigger_reset(struct Gestures* gs)
+{
+	trigger_drag_stop(gs, 0);
+	gs->move_dx = 0;
+	gs->move_dy = 0;
+	gs->move_type = GS_NONE;
+	gs->move_wait = 0;
+	gs->move_dist = 0;
+	gs->move_dir = TR_NONE;
+}
+
+static void gesture_end(struct Gestures* gs)
 {
-	if (gs->move_type == GS_SCALE || hs->evtime >= gs->move_wait) {
-		int scale_dist_sqr = SQRVAL(cfg->scale_dist);
-		trigger_drag_stop(gs, 1);
-		if (gs->move_type != GS_SCALE || gs->move_dir != dir)
-			gs->move_dist = 0;
-		gs->move_dx = 0;
-		gs->move_dy = 0;
-		gs->move_type = GS_SCALE;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
-		gs->move_dist += ABSVAL(dist);
-		gs->move_dir = dir;
-		if (gs->move_dist >= scale_dist_sqr) {
-			gs->move_dist = MODVAL(gs->move_dist, scale_dist_sqr);
-			if (dir == TR_DIR_UP)
-				trigger_button_click(gs, cfg->scale_up_btn - 1, hs->evtime + cfg->gesture_hold);
-			else if (dir == TR_DIR_DN)
-				trigger_button_click(gs, cfg->scale_dn_btn - 1, hs->evtime + cfg->gesture_hold);
-		}
 #ifdef DEBUG_GESTURES
-		xf86Msg(X_INFO, "trigger_scale: scaling %+d in direction %d (at %d of %d)\n", dist, dir, gs->move_dist, scale_dist_sqr);
+	xf86Msg(X_INFO, "gesture_end: gesture %d with %d touches ended\n", gs->gesture_type, gs->gesture_fingers);
 #endif
-	}
+	gs->gesture_ended = gs->gesture_type;
+	gs->gesture_ended_fingers = gs->gesture_fingers;
+	gs->gesture_type = GS_GESTURE_NONE;
+	gs->gesture_fingers = 0;
 }
 
-static void trigger_rotate(struct Gestures* gs,
+/* Follow pinches and swipes once the classifiers below have picked
+ * them up. Runs after them, so move_type says what the touches do.
+ */
+static void gesture_update(struct Gestures* gs,
 			const struct MConfig* cfg,
-			const struct HWState* hs,
-			int dist, int dir)
+			const struct MTState* ms,
+			const int touches[],
+			int count)
 {
-	if (gs->move_type == GS_ROTATE || hs->evtime >= gs->move_wait) {
-		int rotate_dist_sqr = SQRVAL(cfg->rotate_dist);
-		trigger_drag_stop(gs, 1);
-		if (gs->move_type != GS_ROTATE || gs->move_dir != dir)
-			gs->move_dist = 0;
-		gs->move_dx = 0;
-		gs->move_dy = 0;
-		gs->move_type = GS_ROTATE;
-		gs->move_wait = hs->evtime + cfg->gesture_wait;
-		gs->move_dist += ABSVAL(dist);
-		gs->move_dir = dir;
-		if (gs->move_dist >= rotate_dist_sqr) {
-			gs->move_dist = MODVAL(gs->move_dist, rotate_dist_sqr);
-			if (dir == TR_DIR_LT)
-				trigger_button_click(gs, cfg->rotate_lt_btn - 1, hs->evtime + cfg->gesture_hold);
-			else if (dir == TR_DIR_RT)
-				trigger_button_click(gs, cfg->rotate_rt_btn - 1, hs->evtime + cfg->gesture_hold);
+	double x0, y0, x1, y1, d0, d1, a;
+	int i, dx, dy, touching;
+
+	/* end on the lift itself, there may be no frame after it */
+	touching = count;
+	for (i = 0; i < count; i++) {
+		if (GETBIT(ms->touch_released, touches[i]))
+			touching--;
+	}
+	if (gs->gesture_type != GS_GESTURE_NONE && touching != gs->gesture_fingers)
+		gesture_end(gs);
+
+	if (gs->gesture_type == GS_GESTURE_NONE) {
+		if (touching != count)
+			return;
+		if (count == 2 && (gs->move_type == GS_SCALE || gs->move_type == GS_ROTATE)) {
+			gs->gesture_type = GS_GESTURE_PINCH;
+			gs->gesture_scale = 1.0;
 		}
+		else if (count >= 3 && gs->move_type == GS_SWIPE)
+			gs->gesture_type = GS_GESTURE_SWIPE;
+		else
+			return;
+		gs->gesture_fingers = count;
+		gs->gesture_begin = 1;
 #ifdef DEBUG_GESTURES
-		xf86Msg(X_INFO, "trigger_rotate: rotating %+d in direction %d (at %d of %d)\n", dist, dir, gs->move_dist, rotate_dist_sqr);
+		xf86Msg(X_INFO, "gesture_update: gesture %d with %d touches began\n", gs->gesture_type, count);
 #endif
 	}
-}
 
-static void trigger_reset(struct Gestures* gs)
-{
-	trigger_drag_stop(gs, 0);
-	gs->move_dx = 0;
-	gs->move_dy = 0;
-	gs->move_type = GS_NONE;
-	gs->move_wait = 0;
-	gs->move_dist = 0;
-	gs->move_dir = TR_NONE;
+	dx = dy = 0;
+	for (i = 0; i < count; i++) {
+		dx += ms->dx[touches[i]];
+		dy += ms->dy[touches[i]];
+	}
+	gs->gesture_dx = cfg->sensitivity * dx / count;
+	gs->gesture_dy = cfg->sensitivity * dy / count;
+	gs->gesture_angle = 0;
+
+	if (gs->gesture_type == GS_GESTURE_PINCH) {
+		x1 = ms->x[touches[1]] - ms->x[touches[0]];
+		y1 = ms->y[touches[1]] - ms->y[touches[0]];
+		x0 = x1 - (ms->dx[touches[1]] - ms->dx[touches[0]]);
+		y0 = y1 - (ms->dy[touches[1]] - ms->dy[touches[0]]);
+		d0 = sqrt(x0*x0 + y0*y0);
+		d1 = sqrt(x1*x1 + y1*y1);
+		if (d0 > 0 && d1 > 0) {
+			gs->gesture_scale *= d1 / d0;
+			a = (atan2(y1, x1) - atan2(y0, x0)) * 180 / M_PI;
+			if (a > 180)
+				a -= 360;
+			else if (a < -180)
+				a += 360;
+			gs->gesture_angle = a;
+		}
+	}
 }
 
-static int get_scroll_dir(const struct Touch* t1,
-			const struct Touch* t2)
+static int get_scroll_dir(struct MTState* ms,
+			int t1,
+			int t2)
 {
-	if (trig_angles_acute(t1->direction, t2->direction) < 2.0)
-		return trig_generalize(t1->direction);
+	int a1 = mtstate_direction(ms, t1);
+	int a2 = mtstate_direction(ms, t2);
+	if (trig_angles_acute(a1, a2) < TR_ANGLE(2))
+		return trig_generalize(a1);
 	return TR_NONE;
 }
 
-static int get_rotate_dir(const struct Touch* t1,
-			const struct Touch* t2)
+static int get_rotate_dir(struct MTState* ms,
+			int t1,
+			int t2)
 {
-	double v, d1, d2;
-	v = trig_direction(t2->x - t1->x, t2->y - t1->y);
-	d1 = trig_angles_add(v, 2);
-	d2 = trig_angles_sub(v, 2);
-	if (trig_angles_acute(t1->direction, d1) < 2 && trig_angles_acute(t2->direction, d2) < 2)
+	int v, d1, d2;
+	int a1 = mtstate_direction(ms, t1);
+	int a2 = mtstate_direction(ms, t2);
+	v = trig_direction(ms->x[t2] - ms->x[t1], ms->y[t2] - ms->y[t1]);
+	d1 = trig_angles_add(v, TR_ANGLE(2));
+	d2 = trig_angles_sub(v, TR_ANGLE(2));
+	if (trig_angles_acute(a1, d1) < TR_ANGLE(2) && trig_angles_acute(a2, d2) < TR_ANGLE(2))
 		return TR_DIR_RT;
-	else if (trig_angles_acute(t1->direction, d2) < 2 && trig_angles_acute(t2->direction, d1) < 2)
+	else if (trig_angles_acute(a1, d2) < TR_ANGLE(2) && trig_angles_acute(a2, d1) < TR_ANGLE(2))
 		return TR_DIR_LT;
 	return TR_NONE;
 }
 
-static int get_scale_dir(const struct Touch* t1,
-			const struct Touch* t2)
+static int get_scale_dir(struct MTState* ms,
+			int t1,
+			int t2)
 {
-	double v;
-	if (trig_angles_acute(t1->direction, t2->direction) >= 2) {
-		v = trig_direction(t2->x - t1->x, t2->y - t1->y);
-		if (trig_angles_acute(v, t1->direction) < 2)
+	int v;
+	int a1 = mtstate_direction(ms, t1);
+	int a2 = mtstate_direction(ms, t2);
+	if (trig_angles_acute(a1, a2) >= TR_ANGLE(2)) {
+		v = trig_direction(ms->x[t2] - ms->x[t1], ms->y[t2] - ms->y[t1]);
+		if (trig_angles_acute(v, a1) < TR_ANGLE(2))
 			return TR_DIR_DN;
 		else
 			return TR_DIR_UP;
@@ -578,28 +673,37 @@ static int get_scale_dir(const struct Touch* t1,
 	return TR_NONE;
 }
 
-static int get_swipe_dir(const struct Touch* t1,
-			const struct Touch* t2,
-			const struct Touch* t3)
+static int get_swipe_dir(struct MTState* ms,
+			int t1,
+			int t2,
+			int t3)
 {
-	double d1, d2;
-	d1 = MINVAL(t1->direction, MINVAL(t2->direction, t3->direction));
-	d2 = MAXVAL(t1->direction, MAXVAL(t2->direction, t3->direction));
-	if (trig_angles_acute(d1, d2) < 2)
-		return trig_generalize(t1->direction);
+	int d1, d2;
+	int a1 = mtstate_direction(ms, t1);
+	int a2 = mtstate_direction(ms, t2);
+	int a3 = mtstate_direction(ms, t3);
+	d1 = MINVAL(a1, MINVAL(a2, a3));
+	d2 = MAXVAL(a1, MAXVAL(a2, a3));
+	if (trig_angles_acute(d1, d2) < TR_ANGLE(2))
+		return trig_generalize(a1);
 	return TR_NONE;
 }
 
-static int get_swipe4_dir(const struct Touch* t1,
-			const struct Touch* t2,
-			const struct Touch* t3,
-			const struct Touch* t4)
+static int get_swipe4_dir(struct MTState* ms,
+			int t1,
+			int t2,
+			int t3,
+			int t4)
 {
-	double d1, d2;
-	d1 = MINVAL(MINVAL(t1->direction, t2->direction), MINVAL(t3->direction, t4->direction));
-	d2 = MAXVAL(MAXVAL(t1->direction, t2->direction), MAXVAL(t3->direction, t4->direction));
-	if (trig_angles_acute(d1, d2) < 2)
-		return trig_generalize(t1->direction);
+	int d1, d2;
+	int a1 = mtstate_direction(ms, t1);
+	int a2 = mtstate_direction(ms, t2);
+	int a3 = mtstate_direction(ms, t3);
+	int a4 = mtstate_direction(ms, t4);
+	d1 = MINVAL(MINVAL(a1, a2), MINVAL(a3, a4));
+	d2 = MAXVAL(MAXVAL(a1, a2), MAXVAL(a3, a4));
+	if (trig_angles_acute(d1, d2) < TR_ANGLE(2))
+		return trig_generalize(a1);
 	return TR_NONE;
 }
 
@@ -609,28 +713,31 @@ static void moving_update(struct Gestures* gs,
 			struct MTState* ms)
 {
 	int i, count, btn_count, dx, dy, dist, dir;
-	struct Touch* touches[4];
-	count = btn_count = 0;
+	int touches[4];
+	bitmask_t valid, button, moving;
+	count = 0;
 	dx = dy = 0;
 	dir = 0;
 
 	// Reset movement.
 	gs->move_dx = 0;
 	gs->move_dy = 0;
-
-	// Count touches and aggregate touch movements.
-	foreach_bit(i, ms->touch_used) {
-		if (GETBIT(ms->touch[i].state, MT_INVALID))
-			continue;
-		else if (GETBIT(ms->touch[i].flags, GS_BUTTON)) {
-			btn_count++;
-			dx += ms->touch[i].dx;
-			dy += ms->touch[i].dy;
-		}
-		else if (!GETBIT(ms->touch[i].flags, GS_TAP)) {
-			if (count < 4)
-				touches[count++] = &ms->touch[i];
-		}
+	gs->scroll_dx = 0;
+	gs->scroll_dy = 0;
+
+	// Classify touches and aggregate button touch movements.
+	valid = ms->touch_used & ~ms->touch_invalid;
+	button = valid & ms->touch_button;
+	moving = valid & ~ms->touch_button & ~ms->touch_tap;
+	btn_count = bitcount(button);
+	foreach_bit(i, button) {
+		dx += ms->dx[i];
+		dy += ms->dy[i];
+	}
+	foreach_bit(i, moving) {
+		if (count == 4)
+			break;
+		touches[count++] = i;
 	}
 
 	// Determine gesture type.
@@ -641,52 +748,55 @@ static void moving_update(struct Gestures* gs,
 			trigger_reset(gs);
 	}
 	else if (count == 1 && cfg->trackpad_disable < 2) {
-		dx += touches[0]->dx;
-		dy += touches[0]->dy;
+		dx += ms->dx[touches[0]];
+		dy += ms->dy[touches[0]];
 		trigger_move(gs, cfg, hs, dx, dy);
 	}
 	else if (count == 2 && cfg->trackpad_disable < 1) {
 		// scroll, scale, or rotate
-		if ((dir = get_scroll_dir(touches[0], touches[1])) != TR_NONE) {
+		if ((dir = get_scroll_dir(ms, touches[0], touches[1])) != TR_NONE) {
 			if (dir == TR_DIR_LT || dir == TR_DIR_RT)
-				dist = touches[0]->dx + touches[1]->dx;
+				dist = ms->dx[touches[0]] + ms->dx[touches[1]];
 			else
-				dist = touches[0]->dy + touches[1]->dy;
-			trigger_scroll(gs, cfg, hs, dist/2, dir);
+				dist = ms->dy[touches[0]] + ms->dy[touches[1]];
+			trigger_action(gs, cfg, hs, MCFG_ACTION_SCROLL, 2, dist/2, dir);
 		}
-		else if ((dir = get_rotate_dir(touches[0], touches[1])) != TR_NONE) {
-			dist = dist2(touches[0]->dx, touches[0]->dy) + dist2(touches[1]->dx, touches[1]->dy);
-			trigger_rotate(gs, cfg, hs, dist/2, dir);
+		else if ((dir = get_rotate_dir(ms, touches[0], touches[1])) != TR_NONE) {
+			dist = dist2(ms->dx[touches[0]], ms->dy[touches[0]]) + dist2(ms->dx[touches[1]], ms->dy[touches[1]]);
+			trigger_action(gs, cfg, hs, MCFG_ACTION_ROTATE, 2, dist/2, dir);
 		}
-		else if ((dir = get_scale_dir(touches[0], touches[1])) != TR_NONE) {
-			dist = dist2(touches[0]->dx, touches[0]->dy) + dist2(touches[1]->dx, touches[1]->dy);
-			trigger_scale(gs, cfg, hs, dist/2, dir);
+		else if ((dir = get_scale_dir(ms, touches[0], touches[1])) != TR_NONE) {
+			dist = dist2(ms->dx[touches[0]], ms->dy[touches[0]]) + dist2(ms->dx[touches[1]], ms->dy[touches[1]]);
+			trigger_action(gs, cfg, hs, MCFG_ACTION_SCALE, 2, dist/2, dir);
 		}
 	}
 	else if (count == 3 && cfg->trackpad_disable < 1) {
-		if ((dir = get_swipe_dir(touches[0], touches[1], touches[2])) != TR_NONE) {
+		if ((dir = get_swipe_dir(ms, touches[0], touches[1], touches[2])) != TR_NONE) {
 			if (dir == TR_DIR_LT || dir == TR_DIR_RT)
-				dist = touches[0]->dx + touches[1]->dx + touches[2]->dx;
+				dist = ms->dx[touches[0]] + ms->dx[touches[1]] + ms->dx[touches[2]];
 			else
-				dist = touches[0]->dy + touches[1]->dy + touches[2]->dy;
-			trigger_swipe(gs, cfg, hs, dist/3, dir, 0);
+				dist = ms->dy[touches[0]] + ms->dy[touches[1]] + ms->dy[touches[2]];
+			trigger_action(gs, cfg, hs, MCFG_ACTION_SWIPE, 3, dist/3, dir);
 		}
 	}
 	else if (count == 4 && cfg->trackpad_disable < 1) {
-		if ((dir = get_swipe4_dir(touches[0], touches[1], touches[2], touches[3])) != TR_NONE) {
+		if ((dir = get_swipe4_dir(ms, touches[0], touches[1], touches[2], touches[3])) != TR_NONE) {
 			if (dir == TR_DIR_LT || dir == TR_DIR_RT)
-				dist = touches[0]->dx + touches[1]->dx + touches[2]->dx + touches[3]->dx;
+				dist = ms->dx[touches[0]] + ms->dx[touches[1]] + ms->dx[touches[2]] + ms->dx[touches[3]];
 			else
-				dist = touches[0]->dy + touches[1]->dy + touches[2]->dy + touches[2]->dy;
-			trigger_swipe(gs, cfg, hs, dist/4, dir, 1);
+				dist = ms->dy[touches[0]] + ms->dy[touches[1]] + ms->dy[touches[2]] + ms->dy[touches[2]];
+			trigger_action(gs, cfg, hs, MCFG_ACTION_SWIPE, 4, dist/4, dir);
 		}
 	}
+
+	if (cfg->gesture_events)
+		gesture_update(gs, cfg, ms, touches, count);
 }
 
 static void dragging_update(struct Gestures* gs,
 			const struct HWState* hs)
 {
-	if (gs->move_drag == GS_DRAG_READY && hs->evtime > gs->move_drag_expire) {
+	if (gs->move_drag == GS_DRAG_READY && hs->evtime > gs->timeout[GS_TIMEOUT_DRAG]) {
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "dragging_update: drag expired\n");
 #endif
@@ -697,20 +807,12 @@ static void dragging_update(struct Gestures* gs,
 static void delayed_update(struct Gestures* gs,
 			const struct HWState* hs)
 {
-	if (gs->button_delayed_time == 0)
-		return;
-
-	if (hs->evtime >= gs->button_delayed_time) {
+	if (timeout_expired(gs, GS_TIMEOUT_DELAYED, hs->evtime)) {
 #ifdef DEBUG_GESTURES
 		xf86Msg(X_INFO, "delayed_update: %d delay expired, triggering up\n", gs->button_delayed);
 #endif
-		trigger_button_up(gs, gs->button_delayed);
-		gs->button_delayed_time = 0;
-		gs->button_delayed_ms = 0;
-		gs->button_delayed = 0;
+		delayed_release(gs);
 	}
-	else
-		gs->button_delayed_ms = gs->button_delayed_time - hs->evtime;
 }
 
 void gestures_init(struct Gestures* gs)
@@ -718,11 +820,32 @@ void gestures_init(struct Gestures* gs)
 	memset(gs, 0, sizeof(struct Gestures));
 }
 
+void gestures_reset(struct Gestures* gs)
+{
+	bitmask_t held = gs->buttons;
+	bitmask_t hw_buttons = gs->hw_buttons;
+	int type = gs->gesture_type;
+	int fingers = gs->gesture_fingers;
+	double scale = gs->gesture_scale;
+	int i;
+	gestures_init(gs);
+	gs->hw_buttons = hw_buttons;
+	gs->buttons = held;
+	foreach_bit(i, held)
+		button_set(gs, i, 0);
+	gs->gesture_ended = type;
+	gs->gesture_ended_fingers = fingers;
+	gs->gesture_scale = scale;
+}
+
 void gestures_extract(struct Gestures* gs,
 			const struct MConfig* cfg,
 			const struct HWState* hs,
 			struct MTState* ms)
 {
+	gs->button_count = 0;
+	gs->gesture_begin = 0;
+	gs->gesture_ended = GS_GESTURE_NONE;
 	dragging_update(gs, hs);
 	buttons_update(gs, cfg, hs, ms);
 	tapping_update(gs, cfg, hs, ms);
@@ -730,23 +853,51 @@ void gestures_extract(struct Gestures* gs,
 	delayed_update(gs, hs);
 }
 
-int gestures_delayed(struct Gestures* gs,
-			struct mtdev* dev, int fd)
+/* Earliest armed deadline, or 0 if nothing is pending.
+ */
+ustime_t gestures_deadline(const struct Gestures* gs)
+{
+	ustime_t deadline = 0;
+	int i;
+	foreach_bit(i, gs->timeout_used) {
+		if (deadline == 0 || gs->timeout[i] < deadline)
+			deadline = gs->timeout[i];
+	}
+	return deadline;
+}
+
+/* Run every deadline that has passed by now. Called between frames;
+ * returns 1 if button events were queued.
+ */
+int gestures_expire(struct Gestures* gs,
+			struct MTState* ms,
+			ustime_t now)
 {
-	if (gs->button_delayed_time > 0) {
-		if (mtdev_empty(dev) && mtdev_idle(dev, fd, gs->button_delayed_ms)) {
+	gs->button_count = 0;
+	gs->gesture_begin = 0;
+	gs->gesture_ended = GS_GESTURE_NONE;
+	gs->move_dx = 0;
+	gs->move_dy = 0;
+	gs->scroll_dx = 0;
+	gs->scroll_dy = 0;
+	if (timeout_expired(gs, GS_TIMEOUT_TAP, now)) {
 #ifdef DEBUG_GESTURES
-			xf86Msg(X_INFO, "gestures_delayed: %d up, timer expired\n", gs->button_delayed);
+		xf86Msg(X_INFO, "gestures_expire: tap timed out\n");
 #endif
-			trigger_button_up(gs, gs->button_delayed);
-			gs->move_dx = 0;
-			gs->move_dy = 0;
-			gs->button_delayed_time = 0;
-			gs->button_delayed_ms = 0;
-			gs->button_delayed = 0;
-			return 1;
-		}
+		tapping_reset(gs, ms);
+	}
+	if (timeout_expired(gs, GS_TIMEOUT_DRAG, now)) {
+#ifdef DEBUG_GESTURES
+		xf86Msg(X_INFO, "gestures_expire: drag expired\n");
+#endif
+		trigger_drag_stop(gs, 1);
+		timeout_clear(gs, GS_TIMEOUT_DRAG);
 	}
-	return 0;
+	if (timeout_expired(gs, GS_TIMEOUT_DELAYED, now)) {
+#ifdef DEBUG_GESTURES
+		xf86Msg(X_INFO, "gestures_expire: %d up, timer expired\n", gs->button_delayed);
+#endif
+		delayed_release(gs);
+	}
+	return gs->button_count > 0;
 }
-
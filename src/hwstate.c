@@ -20,6 +20,53 @@
  **************************************************************************/
 
 #include "hwstate.h"
+#include <unistd.h>
+#include <poll.h>
+
+/* Complete a packet. Minor axes the device does not report follow the
+ * major ones; which those are is constant in each specialized copy.
+ */
+static force_inline void finish_packet(struct HWState *s,
+				       const struct input_event *syn,
+				       int touch_minor, int width_minor)
+{
+	static const ustime_t us = 1000000;
+	int i;
+	if (!touch_minor || !width_minor) {
+		foreach_bit(i, s->used) {
+			if (!touch_minor)
+				s->data[i].touch_minor = s->data[i].touch_major;
+			if (!width_minor)
+				s->data[i].width_minor = s->data[i].width_major;
+		}
+	}
+	s->evtime = syn->time.tv_usec + syn->time.tv_sec * us;
+	s->changed_slots = s->dirty_slots;
+	s->changed_fields = s->dirty_fields;
+	s->moved_slots = s->dirty_moved;
+	s->dirty_slots = 0;
+	s->dirty_fields = 0;
+	s->dirty_moved = 0;
+}
+
+#define FINISH_PACKET(name, touch_minor, width_minor)			\
+	static void name(struct HWState *s,				\
+			 const struct input_event *syn)			\
+	{								\
+		finish_packet(s, syn, touch_minor, width_minor);	\
+	}
+
+FINISH_PACKET(finish_packet_major, 0, 0)
+FINISH_PACKET(finish_packet_width_minor, 0, 1)
+FINISH_PACKET(finish_packet_touch_minor, 1, 0)
+FINISH_PACKET(finish_packet_minor, 1, 1)
+
+/* Specialized finish_packet by reported touch and width minor axes.
+ */
+static const hwstate_finish_fn finish_packet_variant[2][2] = {
+	{ finish_packet_major, finish_packet_width_minor },
+	{ finish_packet_touch_minor, finish_packet_minor },
+};
 
 void hwstate_init(struct HWState *s, const struct Capabilities *caps)
 {
@@ -29,43 +76,57 @@ void hwstate_init(struct HWState *s, const struct Capabilities *caps)
 		s->data[i].tracking_id = MT_ID_NULL;
 	s->max_x = get_cap_xsize(caps);
 	s->max_y = get_cap_ysize(caps);
+	s->finish = finish_packet_variant[!!caps->has_abs[MTDEV_TOUCH_MINOR]]
+					 [!!caps->has_abs[MTDEV_WIDTH_MINOR]];
 }
 
-static void finish_packet(struct HWState *s, const struct Capabilities *caps,
-			  const struct input_event *syn)
+/* Store a value of the current slot, noting if it changed.
+ */
+static void set_value(struct HWState *s, int *value, int v, int field)
 {
-	static const mstime_t ms = 1000;
-	int i;
-	foreach_bit(i, s->used) {
-		if (!caps->has_abs[MTDEV_TOUCH_MINOR])
-			s->data[i].touch_minor = s->data[i].touch_major;
-		if (!caps->has_abs[MTDEV_WIDTH_MINOR])
-			s->data[i].width_minor = s->data[i].width_major;
-	}
-	s->evtime = syn->time.tv_usec / ms + syn->time.tv_sec * ms;
+	if (*value == v)
+		return;
+	*value = v;
+	SETBIT(s->dirty_slots, s->slot);
+	SETBIT(s->dirty_fields, field);
+	if (field == HW_POSITION)
+		SETBIT(s->dirty_moved, s->slot);
+}
+
+static void set_button(struct HWState *s, int button, int down)
+{
+	if (GETBIT(s->button, button) == !!down)
+		return;
+	MODBIT(s->button, button, down);
+	SETBIT(s->dirty_fields, HW_BUTTON);
 }
 
 static int read_event(struct HWState *s, const struct Capabilities *caps,
                       const struct input_event *ev)
 {
+	/* after a drop, everything up to the next report is incomplete */
+	if (s->dropped && !(ev->type == EV_SYN && ev->code == SYN_REPORT))
+		return 0;
 	switch (ev->type) {
 	case EV_SYN:
 		switch (ev->code) {
 		case SYN_REPORT:
-			finish_packet(s, caps, ev);
 			return 1;
+		case SYN_DROPPED:
+			s->dropped = 1;
+			break;
 		}
 		break;
 	case EV_KEY:
 		switch (ev->code) {
 		case BTN_LEFT:
-			MODBIT(s->button, MT_BUTTON_LEFT, ev->value);
+			set_button(s, MT_BUTTON_LEFT, ev->value);
 			break;
 		case BTN_MIDDLE:
-			MODBIT(s->button, MT_BUTTON_MIDDLE, ev->value);
+			set_button(s, MT_BUTTON_MIDDLE, ev->value);
 			break;
 		case BTN_RIGHT:
-			MODBIT(s->button, MT_BUTTON_RIGHT, ev->value);
+			set_button(s, MT_BUTTON_RIGHT, ev->value);
 			break;
 		}
 		break;
@@ -76,31 +137,31 @@ static int read_event(struct HWState *s, const struct Capabilities *caps,
 				s->slot = ev->value;
 			break;
 		case ABS_MT_TOUCH_MAJOR:
-			s->data[s->slot].touch_major = ev->value;
+			set_value(s, &s->data[s->slot].touch_major, ev->value, HW_SIZE);
 			break;
 		case ABS_MT_TOUCH_MINOR:
-			s->data[s->slot].touch_minor = ev->value;
+			set_value(s, &s->data[s->slot].touch_minor, ev->value, HW_SIZE);
 			break;
 		case ABS_MT_WIDTH_MAJOR:
-			s->data[s->slot].width_major = ev->value;
+			set_value(s, &s->data[s->slot].width_major, ev->value, HW_SIZE);
 			break;
 		case ABS_MT_WIDTH_MINOR:
-			s->data[s->slot].width_minor = ev->value;
+			set_value(s, &s->data[s->slot].width_minor, ev->value, HW_SIZE);
 			break;
 		case ABS_MT_ORIENTATION:
-			s->data[s->slot].orientation = ev->value;
+			set_value(s, &s->data[s->slot].orientation, ev->value, HW_ORIENTATION);
 			break;
 		case ABS_MT_PRESSURE:
-			s->data[s->slot].pressure = ev->value;
+			set_value(s, &s->data[s->slot].pressure, ev->value, HW_PRESSURE);
 			break;
 		case ABS_MT_POSITION_X:
-			s->data[s->slot].position_x = ev->value;
+			set_value(s, &s->position_x[s->slot], ev->value, HW_POSITION);
 			break;
 		case ABS_MT_POSITION_Y:
-			s->data[s->slot].position_y = ev->value;
+			set_value(s, &s->position_y[s->slot], ev->value, HW_POSITION);
 			break;
 		case ABS_MT_TRACKING_ID:
-			s->data[s->slot].tracking_id = ev->value;
+			set_value(s, &s->data[s->slot].tracking_id, ev->value, HW_TRACKING);
 			MODBIT(s->used, s->slot, ev->value != MT_ID_NULL);
 			break;
 		}
@@ -109,23 +170,203 @@ static int read_event(struct HWState *s, const struct Capabilities *caps,
 	return 0;
 }
 
+/* Feed one value per slot through read_event, as if the kernel had
+ * reported it.
+ */
+static void sync_slots(struct HWState *s, const struct Capabilities *caps,
+		       int code, const __s32 *values)
+{
+	struct input_event ev;
+	int i;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EV_ABS;
+	for (i = 0; i < DIM_FINGER; i++) {
+		ev.code = ABS_MT_SLOT;
+		ev.value = i;
+		read_event(s, caps, &ev);
+		ev.code = code;
+		ev.value = values[i];
+		read_event(s, caps, &ev);
+	}
+}
+
+static void sync_key(struct HWState *s, const struct Capabilities *caps,
+		     const unsigned long *keys, int code)
+{
+	static const int bits_per_long = 8 * sizeof(long);
+	struct input_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EV_KEY;
+	ev.code = code;
+	ev.value = (keys[code / bits_per_long] >> (code % bits_per_long)) & 0x01;
+	read_event(s, caps, &ev);
+}
+
+int hwstate_sync(struct HWState *s, const struct Capabilities *caps, int fd)
+{
+	static const int codes[] = {
+		ABS_MT_TOUCH_MAJOR, ABS_MT_TOUCH_MINOR,
+		ABS_MT_WIDTH_MAJOR, ABS_MT_WIDTH_MINOR,
+		ABS_MT_ORIENTATION, ABS_MT_PRESSURE,
+		ABS_MT_POSITION_X, ABS_MT_POSITION_Y,
+	};
+	struct {
+		__u32 code;
+		__s32 values[DIM_FINGER];
+	} req;
+	unsigned long keys[KEY_MAX / (8 * sizeof(long)) + 1];
+	struct input_absinfo slot;
+	int i, rc;
+
+	s->dropped = 0;
+
+	/* unslotted contacts are all resent with the next packet */
+	if (!caps->has_slot) {
+		s->used = 0;
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+		if (!caps->has_abs[mtdev_abs2mt(codes[i])])
+			continue;
+		memset(&req, 0, sizeof(req));
+		req.code = codes[i];
+		SYSCALL(rc = ioctl(fd, EVIOCGMTSLOTS(sizeof(req)), &req));
+		if (rc < 0)
+			return rc;
+		sync_slots(s, caps, codes[i], req.values);
+	}
+	/* tracking ids last, slots the kernel does not report stay empty */
+	for (i = 0; i < DIM_FINGER; i++)
+		req.values[i] = MT_ID_NULL;
+	req.code = ABS_MT_TRACKING_ID;
+	SYSCALL(rc = ioctl(fd, EVIOCGMTSLOTS(sizeof(req)), &req));
+	if (rc < 0)
+		return rc;
+	sync_slots(s, caps, ABS_MT_TRACKING_ID, req.values);
+
+	SYSCALL(rc = ioctl(fd, EVIOCGABS(ABS_MT_SLOT), &slot));
+	if (rc < 0)
+		return rc;
+	s->slot = slot.value >= 0 && slot.value < DIM_FINGER ? slot.value : 0;
+
+	memset(keys, 0, sizeof(keys));
+	SYSCALL(rc = ioctl(fd, EVIOCGKEY(sizeof(keys)), keys));
+	if (rc < 0)
+		return rc;
+	sync_key(s, caps, keys, BTN_LEFT);
+	sync_key(s, caps, keys, BTN_MIDDLE);
+	sync_key(s, caps, keys, BTN_RIGHT);
+	return 0;
+}
+
+/* Refill the event buffer straight from a slotted device.
+ */
+static int fill_buffer_direct(struct EventBuffer *b, int fd)
+{
+	int n;
+	b->head = 0;
+	b->tail = 0;
+	SYSCALL(n = read(fd, b->ev, sizeof(b->ev)));
+	if (n <= 0)
+		return n;
+	b->tail = n / sizeof(struct input_event);
+	b->reads++;
+	b->events += b->tail;
+	return b->tail;
+}
+
+/* Refill the event buffer. Everything the kernel has queued is read
+ * in one go and pushed through mtdev, then as many converted events as
+ * fit are pulled back out. Returns the number of buffered events, or
+ * the read error.
+ */
+static int fill_buffer(struct EventBuffer *b, struct mtdev *dev, int fd)
+{
+	struct input_event kev[DIM_EVENTS];
+	int n, i;
+	if (!dev)
+		return fill_buffer_direct(b, fd);
+	b->head = 0;
+	b->tail = 0;
+	if (mtdev_empty(dev)) {
+		SYSCALL(n = read(fd, kev, sizeof(kev)));
+		if (n <= 0)
+			return n;
+		n /= sizeof(struct input_event);
+		for (i = 0; i < n; i++)
+			mtdev_put_event(dev, &kev[i]);
+		b->reads++;
+		b->events += n;
+	}
+	while (b->tail < DIM_EVENTS && !mtdev_empty(dev))
+		mtdev_get_event(dev, &b->ev[b->tail++]);
+	return b->tail;
+}
+
+/* Drop the events mtdev still holds back. Its contact matching needs
+ * no reset: unslotted devices report every contact in each frame, so
+ * the next one replaces whatever mtdev made of the dropped ones.
+ */
+static void drain_mtdev(struct mtdev *dev)
+{
+	struct input_event ev;
+	if (!dev)
+		return;
+	while (!mtdev_empty(dev))
+		mtdev_get_event(dev, &ev);
+}
+
+/* Drop the packets the kernel still holds from before the snapshot,
+ * up to a report with nothing queued after it. They may select their
+ * slots in earlier packets, which the snapshot replaces by the slot
+ * selected last.
+ */
+static void drain_fd(int fd)
+{
+	struct input_event ev[DIM_EVENTS];
+	int n;
+	do {
+		SYSCALL(n = read(fd, ev, sizeof(ev)));
+	} while (n > 0);
+}
+
 int hwstate_modify(struct HWState *s, struct mtdev *dev, int fd,
 		   const struct Capabilities *caps)
 {
-	struct input_event ev;
+	struct EventBuffer *b = &s->buffer;
+	const struct input_event *ev;
 	int ret;
-	while ((ret = mtdev_get(dev, fd, &ev, 1)) > 0) {
-		if (read_event(s, caps, &ev))
+	for (;;) {
+		while (b->head < b->tail) {
+			ev = &b->ev[b->head++];
+			if (!read_event(s, caps, ev))
+				continue;
+			if (s->dropped) {
+				/* anything still buffered predates the snapshot */
+				b->head = b->tail;
+				drain_mtdev(dev);
+				drain_fd(fd);
+				if (hwstate_sync(s, caps, fd))
+					s->resync_failed++;
+			}
+			s->finish(s, ev);
 			return 1;
+		}
+		ret = fill_buffer(b, dev, fd);
+		if (ret <= 0)
+			return ret;
 	}
-	return ret;
 }
 
-int find_finger(const struct HWState *s, int tracking_id) {
-	int i;
-	foreach_bit(i, s->used) {
-		if (s->data[i].tracking_id == tracking_id)
-			return i;
-	}
-	return -1;
+int hwstate_idle(const struct HWState *s, struct mtdev *dev, int fd, int ms)
+{
+	struct pollfd fds = { fd, POLLIN, 0 };
+	int rc;
+	if (s->buffer.head < s->buffer.tail)
+		return 0;
+	if (dev && !mtdev_empty(dev))
+		return 0;
+	SYSCALL(rc = poll(&fds, 1, ms));
+	return rc == 0;
 }
@@ -20,6 +20,7 @@
  **************************************************************************/
 
 #include "mconfig.h"
+#include "trig.h"
 
 void mconfig_defaults(struct MConfig* cfg)
 {
@@ -36,6 +37,8 @@ void mconfig_defaults(struct MConfig* cfg)
 
 	// Configure Gestures
 	cfg->trackpad_disable = DEFAULT_TRACKPAD_DISABLE;
+	cfg->passthrough = DEFAULT_PASSTHROUGH;
+	cfg->reader_thread = DEFAULT_READER_THREAD;
 	cfg->button_enable = DEFAULT_BUTTON_ENABLE;
 	cfg->button_integrated = DEFAULT_BUTTON_INTEGRATED;
 	cfg->button_expire = DEFAULT_BUTTON_EXPIRE;
@@ -52,11 +55,13 @@ void mconfig_defaults(struct MConfig* cfg)
 	cfg->tap_dist = DEFAULT_TAP_DIST;
 	cfg->gesture_hold = DEFAULT_GESTURE_HOLD;
 	cfg->gesture_wait = DEFAULT_GESTURE_WAIT;
+	cfg->gesture_events = DEFAULT_GESTURE_EVENTS;
 	cfg->scroll_dist = DEFAULT_SCROLL_DIST;
 	cfg->scroll_up_btn = DEFAULT_SCROLL_UP_BTN;
 	cfg->scroll_dn_btn = DEFAULT_SCROLL_DN_BTN;
 	cfg->scroll_lt_btn = DEFAULT_SCROLL_LT_BTN;
 	cfg->scroll_rt_btn = DEFAULT_SCROLL_RT_BTN;
+	cfg->scroll_smooth = DEFAULT_SCROLL_SMOOTH;
 	cfg->swipe_dist = DEFAULT_SWIPE_DIST;
 	cfg->swipe_up_btn = DEFAULT_SWIPE_UP_BTN;
 	cfg->swipe_dn_btn = DEFAULT_SWIPE_DN_BTN;
@@ -113,6 +118,8 @@ void mconfig_init(struct MConfig* cfg,
 
 	if (cfg->touch_minor)
 		xf86Msg(X_INFO, "Touchpad supports minor touch widths.\n");
+
+	mconfig_compile(cfg);
 }
 
 void mconfig_configure(struct MConfig* cfg,
@@ -131,6 +138,8 @@ void mconfig_configure(struct MConfig* cfg,
 
 	// Configure Gestures
 	cfg->trackpad_disable = CLAMPVAL(xf86SetIntOption(opts, "TrackpadDisable", DEFAULT_TRACKPAD_DISABLE), 0, 3);
+	cfg->passthrough = xf86SetBoolOption(opts, "TouchPassthrough", DEFAULT_PASSTHROUGH);
+	cfg->reader_thread = xf86SetBoolOption(opts, "ReaderThread", DEFAULT_READER_THREAD);
 	cfg->button_enable = xf86SetBoolOption(opts, "ButtonEnable", DEFAULT_BUTTON_ENABLE);
 	cfg->button_integrated = xf86SetBoolOption(opts, "ButtonIntegrated", DEFAULT_BUTTON_INTEGRATED);
 	cfg->button_expire = MAXVAL(xf86SetIntOption(opts, "ButtonTouchExpire", DEFAULT_BUTTON_EXPIRE), 0);
@@ -147,11 +156,13 @@ void mconfig_configure(struct MConfig* cfg,
 	cfg->tap_dist = MAXVAL(xf86SetIntOption(opts, "MaxTapMove", DEFAULT_TAP_DIST), 1);
 	cfg->gesture_hold = MAXVAL(xf86SetIntOption(opts, "GestureClickTime", DEFAULT_GESTURE_HOLD), 1);
 	cfg->gesture_wait = MAXVAL(xf86SetIntOption(opts, "GestureWaitTime", DEFAULT_GESTURE_WAIT), 0);
+	cfg->gesture_events = xf86SetBoolOption(opts, "GestureEvents", DEFAULT_GESTURE_EVENTS);
 	cfg->scroll_dist = MAXVAL(xf86SetIntOption(opts, "ScrollDistance", DEFAULT_SCROLL_DIST), 1);
 	cfg->scroll_up_btn = CLAMPVAL(xf86SetIntOption(opts, "ScrollUpButton", DEFAULT_SCROLL_UP_BTN), 0, 32);
 	cfg->scroll_dn_btn = CLAMPVAL(xf86SetIntOption(opts, "ScrollDownButton", DEFAULT_SCROLL_DN_BTN), 0, 32);
 	cfg->scroll_lt_btn = CLAMPVAL(xf86SetIntOption(opts, "ScrollLeftButton", DEFAULT_SCROLL_LT_BTN), 0, 32);
 	cfg->scroll_rt_btn = CLAMPVAL(xf86SetIntOption(opts, "ScrollRightButton", DEFAULT_SCROLL_RT_BTN), 0, 32);
+	cfg->scroll_smooth = xf86SetBoolOption(opts, "ScrollSmooth", DEFAULT_SCROLL_SMOOTH);
 	cfg->swipe_dist = MAXVAL(xf86SetIntOption(opts, "SwipeDistance", DEFAULT_SWIPE_DIST), 1);
 	cfg->swipe_up_btn = CLAMPVAL(xf86SetIntOption(opts, "SwipeUpButton", DEFAULT_SWIPE_UP_BTN), 0, 32);
 	cfg->swipe_dn_btn = CLAMPVAL(xf86SetIntOption(opts, "SwipeDownButton", DEFAULT_SWIPE_DN_BTN), 0, 32);
@@ -175,3 +186,47 @@ void mconfig_configure(struct MConfig* cfg,
 	cfg->sensitivity = MAXVAL(xf86SetRealOption(opts, "Sensitivity", DEFAULT_SENSITIVITY), 0);
 }
 
+
+/* Lowest touch value at or above pct percent of the touch range.
+ */
+static int range_threshold(const struct MConfig* cfg, int pct)
+{
+	int range = MAXVAL(cfg->touch_max - cfg->touch_min, 0);
+	pct = CLAMPVAL(pct, 0, 101);
+	return cfg->touch_min + (pct * range + 99) / 100;
+}
+
+static void action_set(struct MConfig* cfg, int type, int touches,
+			int dir, int button, int dist)
+{
+	cfg->actions[type][touches][dir].button = button;
+	cfg->actions[type][touches][dir].dist = dist;
+}
+
+void mconfig_compile(struct MConfig* cfg)
+{
+	/* a percentage above n starts at n + 1 */
+	cfg->touch_down_raw = range_threshold(cfg, cfg->touch_down + 1);
+	cfg->touch_up_raw = range_threshold(cfg, cfg->touch_up);
+	cfg->thumb_size_raw = range_threshold(cfg, cfg->thumb_size + 1);
+	cfg->palm_size_raw = range_threshold(cfg, cfg->palm_size + 1);
+
+	memset(cfg->actions, 0, sizeof(cfg->actions));
+	action_set(cfg, MCFG_ACTION_SCROLL, 2, TR_DIR_UP, cfg->scroll_up_btn, cfg->scroll_dist);
+	action_set(cfg, MCFG_ACTION_SCROLL, 2, TR_DIR_DN, cfg->scroll_dn_btn, cfg->scroll_dist);
+	action_set(cfg, MCFG_ACTION_SCROLL, 2, TR_DIR_LT, cfg->scroll_lt_btn, cfg->scroll_dist);
+	action_set(cfg, MCFG_ACTION_SCROLL, 2, TR_DIR_RT, cfg->scroll_rt_btn, cfg->scroll_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 3, TR_DIR_UP, cfg->swipe_up_btn, cfg->swipe_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 3, TR_DIR_DN, cfg->swipe_dn_btn, cfg->swipe_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 3, TR_DIR_LT, cfg->swipe_lt_btn, cfg->swipe_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 3, TR_DIR_RT, cfg->swipe_rt_btn, cfg->swipe_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 4, TR_DIR_UP, cfg->swipe4_up_btn, cfg->swipe4_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 4, TR_DIR_DN, cfg->swipe4_dn_btn, cfg->swipe4_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 4, TR_DIR_LT, cfg->swipe4_lt_btn, cfg->swipe4_dist);
+	action_set(cfg, MCFG_ACTION_SWIPE, 4, TR_DIR_RT, cfg->swipe4_rt_btn, cfg->swipe4_dist);
+	/* scale and rotate move by squared distances */
+	action_set(cfg, MCFG_ACTION_SCALE, 2, TR_DIR_UP, cfg->scale_up_btn, SQRVAL(cfg->scale_dist));
+	action_set(cfg, MCFG_ACTION_SCALE, 2, TR_DIR_DN, cfg->scale_dn_btn, SQRVAL(cfg->scale_dist));
+	action_set(cfg, MCFG_ACTION_ROTATE, 2, TR_DIR_LT, cfg->rotate_lt_btn, SQRVAL(cfg->rotate_dist));
+	action_set(cfg, MCFG_ACTION_ROTATE, 2, TR_DIR_RT, cfg->rotate_rt_btn, SQRVAL(cfg->rotate_dist));
+}
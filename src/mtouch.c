@@ -21,6 +21,7 @@
  **************************************************************************/
 
 #include "mtouch.h"
+#include <time.h>
 
 static const int use_grab = 0;
 
@@ -34,16 +35,93 @@ int mtouch_configure(struct MTouch *mt, int fd)
 }
 
 
+/* Stamp events with the monotonic clock so timeouts survive wall clock
+ * changes. Returns the clock the events end up on.
+ */
+static clockid_t set_event_clock(int fd)
+{
+#ifdef EVIOCSCLOCKID
+	int ret, clk = CLOCK_MONOTONIC;
+	SYSCALL(ret = ioctl(fd, EVIOCSCLOCKID, &clk));
+	if (ret == 0)
+		return CLOCK_MONOTONIC;
+	xf86Msg(X_WARNING, "mtrack: could not select monotonic event clock\n");
+#else
+	xf86Msg(X_WARNING, "mtrack: monotonic event clock not supported, using wall clock\n");
+#endif
+	return CLOCK_REALTIME;
+}
+
+/* The HW_* kinds of values the touch tracking reads for the touch
+ * type of the config.
+ */
+static bitmask_t frame_fields(const struct MConfig *cfg)
+{
+	bitmask_t fields = BITMASK(HW_POSITION) | BITMASK(HW_TRACKING) | BITMASK(HW_BUTTON);
+	if (cfg->touch_type == MCFG_SCALE || cfg->touch_type == MCFG_SIZE)
+		SETBIT(fields, HW_SIZE);
+	else if (cfg->touch_type == MCFG_PRESSURE)
+		SETBIT(fields, HW_PRESSURE);
+	return fields;
+}
+
+#define CFG_FRESH 4
+
+static void config_init(struct MTouch *mt)
+{
+	int i;
+	for (i = 0; i < 3; i++)
+		mt->cfg_copy[i] = mt->cfg;
+	mt->cfg_front = 0;
+	mt->cfg_middle = 1;
+	mt->cfg_back = 2;
+	mt->cfg_live = &mt->cfg_copy[0];
+}
+
+void mtouch_publish_config(struct MTouch *mt)
+{
+	struct MConfig *back = &mt->cfg_copy[mt->cfg_back];
+	*back = mt->cfg;
+	mconfig_compile(back);
+	mt->cfg_back = __atomic_exchange_n(&mt->cfg_middle, mt->cfg_back | CFG_FRESH,
+					   __ATOMIC_ACQ_REL) & ~CFG_FRESH;
+}
+
+/* Take the last published config, if there is one not taken yet. The
+ * copy given back is only reused once published over again.
+ */
+static void adopt_config(struct MTouch *mt)
+{
+	if (!(__atomic_load_n(&mt->cfg_middle, __ATOMIC_RELAXED) & CFG_FRESH))
+		return;
+	mt->cfg_front = __atomic_exchange_n(&mt->cfg_middle, mt->cfg_front,
+					    __ATOMIC_ACQ_REL) & ~CFG_FRESH;
+	mt->cfg_live = &mt->cfg_copy[mt->cfg_front];
+}
+
 int mtouch_open(struct MTouch *mt, int fd)
 {
 	int ret;
-	ret = mtdev_open(&mt->dev, fd);
-	if (ret)
-		goto error;
+	mt->clock = set_event_clock(fd);
+	mt->dev = NULL;
+	if (!mt->caps.has_slot) {
+		mt->dev = calloc(1, sizeof(struct mtdev));
+		if (!mt->dev)
+			return -ENOMEM;
+		ret = mtdev_open(mt->dev, fd);
+		if (ret)
+			goto error;
+	}
 	mconfig_init(&mt->cfg, &mt->caps);
+	config_init(mt);
+	mt->frame_fields = frame_fields(&mt->cfg);
 	hwstate_init(&mt->hs, &mt->caps);
-	mtstate_init(&mt->state);
+	if (hwstate_sync(&mt->hs, &mt->caps, fd))
+		xf86Msg(X_WARNING, "mtrack: could not read initial touch state\n");
+	mtstate_init(&mt->state, &mt->cfg);
 	gestures_init(&mt->gs);
+	mt->passthrough_used = 0;
+	mt->reader = NULL;
 	if (use_grab) {
 		SYSCALL(ret = ioctl(fd, EVIOCGRAB, 1));
 		if (ret)
@@ -51,8 +129,11 @@ int mtouch_open(struct MTouch *mt, int fd)
 	}
 	return 0;
  close:
-	mtdev_close(&mt->dev);
+	if (mt->dev)
+		mtdev_close(mt->dev);
  error:
+	free(mt->dev);
+	mt->dev = NULL;
 	return ret;
 }
 
@@ -65,22 +146,116 @@ int mtouch_close(struct MTouch *mt, int fd)
 		if (ret)
 			xf86Msg(X_WARNING, "mtouch: ungrab failed\n");
 	}
-	mtdev_close(&mt->dev);
+	if (mt->hs.buffer.reads > 0)
+		xf86Msg(X_INFO, "mtrack: %llu events in %llu reads (%.1f per read)\n",
+			mt->hs.buffer.events, mt->hs.buffer.reads,
+			(double)mt->hs.buffer.events / mt->hs.buffer.reads);
+	if (mt->dev) {
+		mtdev_close(mt->dev);
+		free(mt->dev);
+		mt->dev = NULL;
+	}
 	return 0;
 }
 
+/* Check if a frame can be skipped. That is when none of the values
+ * the touch tracking reads changed, the last frame left all touches
+ * at rest and no gesture deadline has passed.
+ */
+static int frame_unchanged(const struct MTouch *mt)
+{
+	ustime_t deadline;
+	if (mt->hs.changed_fields & mt->frame_fields)
+		return 0;
+	if (mt->passthrough)
+		return 1;
+	if (!mt->state.settled)
+		return 0;
+	deadline = gestures_deadline(&mt->gs);
+	return deadline == 0 || deadline > mt->hs.evtime;
+}
+
+/* Follow a change of cfg.passthrough. Entering passthrough resets the
+ * gestures, queueing releases of the buttons still down; leaving it
+ * starts touch tracking over. Returns 1 if the mode changed.
+ */
+int mtouch_update_mode(struct MTouch *mt)
+{
+	adopt_config(mt);
+	if (mt->passthrough == mt->cfg_live->passthrough)
+		return 0;
+	if (mt->cfg_live->passthrough)
+		gestures_reset(&mt->gs);
+	else
+		mtstate_init(&mt->state, mt->cfg_live);
+	mt->passthrough = mt->cfg_live->passthrough;
+	return 1;
+}
+
 int read_packet(struct MTouch *mt, int fd)
 {
-	int ret = hwstate_modify(&mt->hs, &mt->dev, fd, &mt->caps);
-	if (ret <= 0)
-		return ret;
-	mtstate_extract(&mt->state, &mt->cfg, &mt->hs);
-	gestures_extract(&mt->gs, &mt->cfg, &mt->hs, &mt->state);
+	int ret;
+	adopt_config(mt);
+	do {
+		ret = hwstate_modify(&mt->hs, mt->dev, fd, &mt->caps);
+		if (ret <= 0)
+			return ret;
+	} while (frame_unchanged(mt));
+	if (mt->passthrough)
+		return 1;
+	mtstate_extract(&mt->state, mt->cfg_live, &mt->hs);
+	gestures_extract(&mt->gs, mt->cfg_live, &mt->hs, &mt->state);
 	return 1;
 }
 
-int has_delayed(struct MTouch *mt, int fd)
+/* Current time on the clock that stamps the events.
+ */
+ustime_t mtouch_time(const struct MTouch *mt)
 {
-	return gestures_delayed(&mt->gs, &mt->dev, fd);
+	struct timespec ts;
+	clock_gettime(mt->clock, &ts);
+	return ts.tv_nsec / 1000 + (ustime_t)ts.tv_sec * 1000000;
 }
 
+/* Milliseconds until the next gesture deadline, or -1 if none is
+ * pending.
+ */
+int mtouch_timeout(const struct MTouch *mt)
+{
+	ustime_t deadline = gestures_deadline(&mt->gs);
+	ustime_t now;
+	if (deadline == 0)
+		return -1;
+	now = mtouch_time(mt);
+	if (now >= deadline)
+		return 0;
+	return (deadline - now + 999) / 1000;
+}
+
+/* Expire the gesture deadlines that have passed. Never blocks; if more
+ * input is waiting, the next packet decides instead.
+ */
+int read_timeouts(struct MTouch *mt, int fd)
+{
+	if (gestures_deadline(&mt->gs) == 0)
+		return 0;
+	if (!hwstate_idle(&mt->hs, mt->dev, fd, 0))
+		return 0;
+	return gestures_expire(&mt->gs, &mt->state, mtouch_time(mt));
+}
+
+void mtouch_take_warnings(struct MTouch *mt, struct MWarnings *w)
+{
+	w->resync_failed = mt->hs.resync_failed;
+	w->touches_ignored = mt->state.touches_ignored;
+	mt->hs.resync_failed = 0;
+	mt->state.touches_ignored = 0;
+}
+
+void mtouch_log_warnings(const struct MWarnings *w)
+{
+	if (w->resync_failed)
+		xf86Msg(X_WARNING, "mtrack: resync after dropped events failed\n");
+	if (w->touches_ignored)
+		xf86Msg(X_WARNING, "Too many touches to track. Ignoring %d.\n", w->touches_ignored);
+}
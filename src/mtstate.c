@@ -23,239 +23,311 @@
 #include "mtstate.h"
 #include "trig.h"
 
-static int inline percentage(int dividend, int divisor)
+/* Check if a is more than pct percent of b, without dividing.
+ */
+static int inline above_percentage(int a, int b, int pct)
 {
-	return (double)dividend / (double)divisor * 100;
+	return 100 * a >= (pct + 1) * b;
 }
 
-static int inline touch_range_ratio(const struct MConfig* cfg, int value)
-{
-	return (double)(value - cfg->touch_min) / (double)(cfg->touch_max - cfg->touch_min) * 100;
-}
+/* The classification below takes the touch type and whether touches
+ * have a minor axis as arguments rather than from the config. They are
+ * constants in each specialized touches_update, which leaves no
+ * capability branches per finger.
+ */
 
 /* Check if a finger is touching the trackpad.
  */
-static int is_touch(const struct MConfig* cfg,
-			const struct FingerState* hw)
+static force_inline int is_touch(const struct MConfig* cfg,
+			const struct FingerState* hw,
+			int type)
 {
-	if (cfg->touch_type == MCFG_SCALE)
-		return percentage(hw->touch_major, hw->width_major) > cfg->touch_down;
-	else if (cfg->touch_type == MCFG_SIZE)
-		return touch_range_ratio(cfg, hw->touch_major) > cfg->touch_down;
-	else if (cfg->touch_type == MCFG_PRESSURE)
-		return touch_range_ratio(cfg, hw->pressure) > cfg->touch_down;
+	if (type == MCFG_SCALE)
+		return above_percentage(hw->touch_major, hw->width_major, cfg->touch_down);
+	else if (type == MCFG_SIZE)
+		return hw->touch_major >= cfg->touch_down_raw;
+	else if (type == MCFG_PRESSURE)
+		return hw->pressure >= cfg->touch_down_raw;
 	else
 		return 1;
 }
 
 /* Check if a finger is released from the touchpad.
  */
-static int is_release(const struct MConfig* cfg,
-			const struct FingerState* hw)
+static force_inline int is_release(const struct MConfig* cfg,
+			const struct FingerState* hw,
+			int type)
 {
-	if (cfg->touch_type == MCFG_SCALE)
-		return percentage(hw->touch_major, hw->width_major) < cfg->touch_up;
-	else if (cfg->touch_type == MCFG_SIZE)
-		return touch_range_ratio(cfg, hw->touch_major) < cfg->touch_up;
-	else if (cfg->touch_type == MCFG_PRESSURE)
-		return touch_range_ratio(cfg, hw->pressure) < cfg->touch_up;
+	if (type == MCFG_SCALE)
+		return 100 * hw->touch_major < cfg->touch_up * hw->width_major;
+	else if (type == MCFG_SIZE)
+		return hw->touch_major < cfg->touch_up_raw;
+	else if (type == MCFG_PRESSURE)
+		return hw->pressure < cfg->touch_up_raw;
 	else
 		return 0;
 }
 
-static int is_thumb(const struct MConfig* cfg,
-			const struct FingerState* hw)
+static force_inline int is_thumb(const struct MConfig* cfg,
+			const struct FingerState* hw,
+			int minor)
 {
-	if (!cfg->touch_minor)
+	if (!minor)
 		return 0;
 
 	int min = MINVAL(hw->touch_minor, hw->touch_major);
 	int max = MAXVAL(hw->touch_minor, hw->touch_major);
-	int pct = percentage(min, max);
-	int size = touch_range_ratio(cfg, hw->touch_major);
 
-	if (percentage(min, max) > cfg->thumb_ratio && size > cfg->thumb_size) {
+	if (above_percentage(min, max, cfg->thumb_ratio) && hw->touch_major >= cfg->thumb_size_raw) {
 #if DEBUG_MTSTATE
-		xf86Msg(X_INFO, "is_thumb: yes %d > %d && %d > %d\n",
-			pct, cfg->thumb_ratio, size, cfg->thumb_size);
+		xf86Msg(X_INFO, "is_thumb: yes %d/%d > %d%% && %d >= %d\n",
+			min, max, cfg->thumb_ratio, hw->touch_major, cfg->thumb_size_raw);
 #endif
 		return 1;
 	}
 	else {
 #if DEBUG_MTSTATE
-		xf86Msg(X_INFO, "is_thumb: no  %d > %d && %d > %d\n",
-			pct, cfg->thumb_ratio, size, cfg->thumb_size);
+		xf86Msg(X_INFO, "is_thumb: no  %d/%d > %d%% && %d >= %d\n",
+			min, max, cfg->thumb_ratio, hw->touch_major, cfg->thumb_size_raw);
 #endif
 		return 0;
 	}
 }
 
-static int is_palm(const struct MConfig* cfg,
-			const struct FingerState* hw)
+static force_inline int is_palm(const struct MConfig* cfg,
+			const struct FingerState* hw,
+			int type)
 {
-	if (cfg->touch_type != MCFG_SCALE && cfg->touch_type != MCFG_SIZE)
+	if (type != MCFG_SCALE && type != MCFG_SIZE)
 		return 0;
 
-	int size = touch_range_ratio(cfg, hw->touch_major);
-	if (size > cfg->palm_size) {
+	if (hw->touch_major >= cfg->palm_size_raw) {
 #if DEBUG_MTSTATE
-		xf86Msg(X_INFO, "is_palm: yes %d > %d\n", size, cfg->palm_size);
+		xf86Msg(X_INFO, "is_palm: yes %d >= %d\n", hw->touch_major, cfg->palm_size_raw);
 #endif
 		return 1;
 	}
 	else {
 #if DEBUG_MTSTATE
-		xf86Msg(X_INFO, "is_palm: no  %d > %d\n", size, cfg->palm_size);
+		xf86Msg(X_INFO, "is_palm: no  %d >= %d\n", hw->touch_major, cfg->palm_size_raw);
 #endif
 		return 0;
 	}
 }
 
-/* Find a touch by its tracking ID.  Return -1 if not found.
- */
-static int find_touch(struct MTState* ms,
-			int tracking_id)
-{
-	int i;
-	foreach_bit(i, ms->touch_used) {
-		if (ms->touch[i].tracking_id == tracking_id)
-			return i;
-	}
-	return -1;
-}
-
 /* Add a touch to the MTState.  Return the new index of the touch.
  */
 static int touch_append(struct MTState* ms,
-			const struct FingerState* fs)
+			const struct HWState* hs,
+			int slot)
 {
 	int n = firstbit(~ms->touch_used);
 	if (n < 0)
-		xf86Msg(X_WARNING, "Too many touches to track. Ignoring touch %d.\n", fs->tracking_id);
+		ms->touches_ignored++;
 	else {
-		ms->touch[n].state = 0U;
-		ms->touch[n].flags = 0U;
 		ms->touch[n].down = ms->evtime;
-		ms->touch[n].direction = TR_NONE;
-		ms->touch[n].tracking_id = fs->tracking_id;
-		ms->touch[n].x = fs->position_x;
-		ms->touch[n].y = fs->position_y;
-		ms->touch[n].dx = 0;
-		ms->touch[n].dy = 0;
-		ms->touch[n].total_dx = 0;
-		ms->touch[n].total_dy = 0;
-		SETBIT(ms->touch[n].state, MT_NEW);
+		ms->touch[n].direction = TR_ANGLE_NONE;
+		ms->touch[n].tracking_id = hs->data[slot].tracking_id;
+		ms->x[n] = ms->last_x[n] = hs->position_x[slot];
+		ms->y[n] = ms->last_y[n] = hs->position_y[slot];
+		ms->total_dx[n] = 0;
+		ms->total_dy[n] = 0;
+		SETBIT(ms->touch_new, n);
 		SETBIT(ms->touch_used, n);
 	}
 	return n;
 }
 
-/* Update a touch.
+/* Release a touch.
  */
-static void touch_update(struct MTState* ms,
-			const struct FingerState* fs,
+static void touch_release(struct MTState* ms,
 			int touch)
 {
-	ms->touch[touch].dx = fs->position_x - ms->touch[touch].x;
-	ms->touch[touch].dy = fs->position_y - ms->touch[touch].y;
-	ms->touch[touch].total_dx += ms->touch[touch].dx;
-	ms->touch[touch].total_dy += ms->touch[touch].dy;
-	ms->touch[touch].x = fs->position_x;
-	ms->touch[touch].y = fs->position_y;
-	ms->touch[touch].direction = trig_direction(ms->touch[touch].dx, ms->touch[touch].dy);
-	CLEARBIT(ms->touch[touch].state, MT_NEW);
+	ms->touch[touch].direction = TR_ANGLE_NONE;
+	CLEARBIT(ms->touch_new, touch);
+	SETBIT(ms->touch_released, touch);
 }
 
-/* Release a touch.
+/* Update the deltas of all touches from the positions of the last
+ * frame. Touches that did not move still have their old position, so
+ * this is one branch free pass the compiler can vectorize. Touches are
+ * allocated from the bottom, the pass stops at the vector of the last
+ * used one.
  */
-static void touch_release(struct MTState* ms,
-			int touch)
+static void touches_move(struct MTState* ms)
 {
-	ms->touch[touch].dx = 0;
-	ms->touch[touch].dy = 0;
-	ms->touch[touch].direction = TR_NONE;
-	CLEARBIT(ms->touch[touch].state, MT_NEW);
-	SETBIT(ms->touch[touch].state, MT_RELEASED);
+	int i, n = (lastbit(ms->touch_used) + 4) & ~3;
+	for (i = 0; i < n; i++) {
+		ms->dx[i] = ms->x[i] - ms->last_x[i];
+		ms->dy[i] = ms->y[i] - ms->last_y[i];
+		ms->total_dx[i] += ms->dx[i];
+		ms->total_dy[i] += ms->dy[i];
+		ms->last_x[i] = ms->x[i];
+		ms->last_y[i] = ms->y[i];
+	}
 }
 
 /* Invalidate all touches.
  */
 static void touches_invalidate(struct MTState* ms)
 {
-	int i;
-	foreach_bit(i, ms->touch_used)
-		SETBIT(ms->touch[i].state, MT_INVALID);
+	ms->touch_invalid = ms->touch_used;
 }
 
-/* Update all touches.
+/* Update all touches, for touches of the given type and with or
+ * without a minor axis.
  */
-static void touches_update(struct MTState* ms,
+static force_inline void touches_update(struct MTState* ms,
 			const struct MConfig* cfg,
-			const struct HWState* hs)
+			const struct HWState* hs,
+			int type, int minor)
 {
 	int i, n, disable = 0;
-	// Release missing touches.
-	foreach_bit(i, ms->touch_used) {
-		if (find_finger(hs, ms->touch[i].tracking_id) == -1)
-			touch_release(ms, i);
+	bitmask_t lifted, present, changed = 0, moved = 0;
+	// Touches left from the last frame are no longer new.
+	ms->touch_new = 0;
+	// Release touches of lifted fingers.
+	lifted = ms->slot_used & ~hs->used;
+	foreach_bit(i, lifted) {
+		touch_release(ms, ms->slot_touch[i]);
+		SETBIT(changed, ms->slot_touch[i]);
 	}
+	ms->slot_used &= hs->used;
+	present = ms->touch_used & ~ms->touch_released;
 	// Add and update touches.
 	foreach_bit(i, hs->used) {
-		n = find_touch(ms, hs->data[i].tracking_id);
+		n = -1;
+		if (GETBIT(ms->slot_used, i)) {
+			n = ms->slot_touch[i];
+			// Slot reused by a new finger within one frame.
+			if (ms->touch[n].tracking_id != hs->data[i].tracking_id) {
+				touch_release(ms, n);
+				SETBIT(changed, n);
+				CLEARBIT(present, n);
+				CLEARBIT(ms->slot_used, i);
+				n = -1;
+			}
+		}
 		if (n >= 0) {
-			if (is_release(cfg, &hs->data[i]))
+			if (is_release(cfg, &hs->data[i], type)) {
 				touch_release(ms, n);
-			else
-				touch_update(ms, &hs->data[i], n);
+				CLEARBIT(ms->slot_used, i);
+				SETBIT(changed, n);
+			}
+			else {
+				if (GETBIT(hs->moved_slots, i)) {
+					ms->x[n] = hs->position_x[i];
+					ms->y[n] = hs->position_y[i];
+					SETBIT(moved, n);
+				}
+				else
+					ms->touch[n].direction = TR_ANGLE_NONE;
+			}
+		}
+		else if (is_touch(cfg, &hs->data[i], type)) {
+			n = touch_append(ms, hs, i);
+			if (n >= 0) {
+				SETBIT(changed, n);
+				SETBIT(present, n);
+				ms->slot_touch[i] = n;
+				SETBIT(ms->slot_used, i);
+			}
 		}
-		else if (is_touch(cfg, &hs->data[i]))
-			n = touch_append(ms, &hs->data[i]);
 
 		if (n >= 0) {
 			// Track and invalidate thumb and palm touches.
-			if (!GETBIT(ms->touch[n].state, MT_INVALID)) {
-				if (is_thumb(cfg, &hs->data[i])) {
+			if (!GETBIT(ms->touch_invalid, n)) {
+				if (is_thumb(cfg, &hs->data[i], minor)) {
 					if (cfg->ignore_thumb)
-						SETBIT(ms->touch[n].state, MT_INVALID);
-					SETBIT(ms->touch[n].state, MT_THUMB);
+						SETBIT(ms->touch_invalid, n);
+					SETBIT(ms->touch_thumb, n);
 				}
-				if (is_palm(cfg, &hs->data[i])) {
+				if (is_palm(cfg, &hs->data[i], type)) {
 					if (cfg->ignore_palm)
-						SETBIT(ms->touch[n].state, MT_INVALID);
-					SETBIT(ms->touch[n].state, MT_PALM);
+						SETBIT(ms->touch_invalid, n);
+					SETBIT(ms->touch_palm, n);
 				}
 			}
-			if (GETBIT(ms->touch[n].state, MT_THUMB)) {
-				SETBIT(ms->state, MT_THUMB);
-				if (cfg->disable_on_thumb)
-					disable = 1;
-			}
-			if (GETBIT(ms->touch[n].state, MT_PALM)) {
-				SETBIT(ms->state, MT_PALM);
-				if (cfg->disable_on_palm)
-					disable = 1;
-			}
 		}
 	}
 
+	// Thumbs and palms of fingers the hardware still reports.
+	if (ms->touch_thumb & present) {
+		SETBIT(ms->state, MT_THUMB);
+		if (cfg->disable_on_thumb)
+			disable = 1;
+	}
+	if (ms->touch_palm & present) {
+		SETBIT(ms->state, MT_PALM);
+		if (cfg->disable_on_palm)
+			disable = 1;
+	}
+
+	// Update deltas. Directions of touches that moved are left to
+	// the first reader.
+	touches_move(ms);
+	foreach_bit(i, moved) {
+		if (ms->dx[i] || ms->dy[i])
+			SETBIT(changed, i);
+	}
+	ms->direction_stale = moved;
+	ms->settled = !changed;
+
 	if (disable)
 		touches_invalidate(ms);
 }
 
+#define TOUCHES_UPDATE(name, type, minor)				\
+	static void name(struct MTState* ms,				\
+			const struct MConfig* cfg,			\
+			const struct HWState* hs)			\
+	{								\
+		touches_update(ms, cfg, hs, type, minor);		\
+	}
+
+TOUCHES_UPDATE(touches_update_none, MCFG_NONE, 0)
+TOUCHES_UPDATE(touches_update_none_minor, MCFG_NONE, 1)
+TOUCHES_UPDATE(touches_update_scale, MCFG_SCALE, 0)
+TOUCHES_UPDATE(touches_update_scale_minor, MCFG_SCALE, 1)
+TOUCHES_UPDATE(touches_update_size, MCFG_SIZE, 0)
+TOUCHES_UPDATE(touches_update_size_minor, MCFG_SIZE, 1)
+TOUCHES_UPDATE(touches_update_pressure, MCFG_PRESSURE, 0)
+TOUCHES_UPDATE(touches_update_pressure_minor, MCFG_PRESSURE, 1)
+
+/* Specialized touches_update by touch type and minor axis.
+ */
+static const mtstate_update_fn touches_update_variant[4][2] = {
+	[MCFG_NONE] = { touches_update_none, touches_update_none_minor },
+	[MCFG_SCALE] = { touches_update_scale, touches_update_scale_minor },
+	[MCFG_SIZE] = { touches_update_size, touches_update_size_minor },
+	[MCFG_PRESSURE] = { touches_update_pressure, touches_update_pressure_minor },
+};
+
 /* Remove released touches.
  */
 static void touches_clean(struct MTState* ms)
 {
-	int i, used;
-	used = ms->touch_used;
-	foreach_bit(i, used) {
-		if (GETBIT(ms->touch[i].state, MT_RELEASED))
-			CLEARBIT(ms->touch_used, i);
+	bitmask_t keep = ~ms->touch_released;
+	ms->touch_used &= keep;
+	ms->touch_invalid &= keep;
+	ms->touch_thumb &= keep;
+	ms->touch_palm &= keep;
+	ms->touch_button &= keep;
+	ms->touch_tap &= keep;
+	ms->touch_released = 0;
+}
+
+int mtstate_direction(struct MTState* ms, int touch)
+{
+	if (GETBIT(ms->direction_stale, touch)) {
+		ms->touch[touch].direction = trig_direction(ms->dx[touch], ms->dy[touch]);
+		CLEARBIT(ms->direction_stale, touch);
 	}
+	return ms->touch[touch].direction;
 }
 
 #if DEBUG_MTSTATE
-void mtstate_output(const struct MTState* ms)
+void mtstate_output(struct MTState* ms)
 {
 	int i, n;
 	char* type;
@@ -263,33 +335,35 @@ void mtstate_output(const struct MTState* ms)
 	//if (bitcount(ms->touch_used) > 0)
 	//	xf86Msg(X_INFO, "mtstate: %d touches at event time is %llu\n", n, ms->evtime);
 	foreach_bit(i, ms->touch_used) {
-		if (GETBIT(ms->touch[i].state, MT_RELEASED)) {
-			xf86Msg(X_INFO, "  released p(%d, %d) d(%+d, %+d) dir(%f) down(%llu) time(%lld)\n",
-						ms->touch[i].x, ms->touch[i].y, ms->touch[i].dx, ms->touch[i].dy,
-						ms->touch[i].direction, ms->touch[i].down, ms->evtime - ms->touch[i].down);
+		if (GETBIT(ms->touch_released, i)) {
+			xf86Msg(X_INFO, "  released p(%d, %d) d(%+d, %+d) dir(%d) down(%llu) time(%lld)\n",
+						ms->x[i], ms->y[i], ms->dx[i], ms->dy[i],
+						mtstate_direction(ms, i), ms->touch[i].down, ms->evtime - ms->touch[i].down);
 		}
-		else if (GETBIT(ms->touch[i].state, MT_NEW)) {
-			xf86Msg(X_INFO, "  new      p(%d, %d) d(%+d, %+d) dir(%f) down(%llu)\n",
-						ms->touch[i].x, ms->touch[i].y, ms->touch[i].dx, ms->touch[i].dy,
-						ms->touch[i].direction, ms->touch[i].down);
+		else if (GETBIT(ms->touch_new, i)) {
+			xf86Msg(X_INFO, "  new      p(%d, %d) d(%+d, %+d) dir(%d) down(%llu)\n",
+						ms->x[i], ms->y[i], ms->dx[i], ms->dy[i],
+						mtstate_direction(ms, i), ms->touch[i].down);
 		}
-		else if (GETBIT(ms->touch[i].state, MT_INVALID)) {
-			xf86Msg(X_INFO, "  invalid  p(%d, %d) d(%+d, %+d) dir(%f) down(%llu) time(%lld)\n",
-						ms->touch[i].x, ms->touch[i].y, ms->touch[i].dx, ms->touch[i].dy,
-						ms->touch[i].direction, ms->touch[i].down, ms->evtime - ms->touch[i].down);
+		else if (GETBIT(ms->touch_invalid, i)) {
+			xf86Msg(X_INFO, "  invalid  p(%d, %d) d(%+d, %+d) dir(%d) down(%llu) time(%lld)\n",
+						ms->x[i], ms->y[i], ms->dx[i], ms->dy[i],
+						mtstate_direction(ms, i), ms->touch[i].down, ms->evtime - ms->touch[i].down);
 		}
 		else {
-			xf86Msg(X_INFO, "  touching p(%d, %d) d(%+d, %+d) dir(%f) down(%llu)\n",
-						ms->touch[i].x, ms->touch[i].y, ms->touch[i].dx, ms->touch[i].dy,
-						ms->touch[i].direction, ms->touch[i].down);
+			xf86Msg(X_INFO, "  touching p(%d, %d) d(%+d, %+d) dir(%d) down(%llu)\n",
+						ms->x[i], ms->y[i], ms->dx[i], ms->dy[i],
+						mtstate_direction(ms, i), ms->touch[i].down);
 		}
 	}
 }
 #endif
 
-void mtstate_init(struct MTState* ms)
+void mtstate_init(struct MTState* ms,
+			const struct MConfig* cfg)
 {
 	memset(ms, 0, sizeof(struct MTState));
+	ms->update = touches_update_variant[cfg->touch_type][!!cfg->touch_minor];
 }
 
 // Process changes in touch state.
@@ -301,7 +375,7 @@ void mtstate_extract(struct MTState* ms,
 	ms->evtime = hs->evtime;
 
 	touches_clean(ms);
-	touches_update(ms, cfg, hs);
+	ms->update(ms, cfg, hs);
 
 #if DEBUG_MTSTATE
 	mtstate_output(ms);
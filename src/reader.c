@@ -0,0 +1,237 @@
+/***************************************************************************
+ *
+ * Multitouch X driver
+ * Copyright (C) 2008 Henrik Rydberg <rydberg@euromail.se>
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "reader.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+void slotframe_extract(struct SlotFrame *sf, const struct HWState *hs)
+{
+	int i;
+	sf->used = hs->used;
+	sf->moved = hs->moved_slots;
+	foreach_bit(i, hs->used) {
+		sf->tracking_id[i] = hs->data[i].tracking_id;
+		sf->x[i] = hs->position_x[i];
+		sf->y[i] = hs->position_y[i];
+	}
+}
+
+/* Each side reads the index the other one moves with acquire, and
+ * moves its own with release once done with the frame, so a frame is
+ * never read while written or written while read.
+ */
+static struct ReaderFrame *ring_next_free(struct FrameRing *ring)
+{
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (ring->head - tail == DIM_FRAMES)
+		return NULL;
+	return &ring->frame[ring->head % DIM_FRAMES];
+}
+
+static void ring_push(struct FrameRing *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+const struct ReaderFrame *reader_peek(struct Reader *r)
+{
+	unsigned head = __atomic_load_n(&r->ring.head, __ATOMIC_ACQUIRE);
+	if (head == r->ring.tail)
+		return NULL;
+	return &r->ring.frame[r->ring.tail % DIM_FRAMES];
+}
+
+void reader_pop(struct Reader *r)
+{
+	__atomic_store_n(&r->ring.tail, r->ring.tail + 1, __ATOMIC_RELEASE);
+}
+
+int reader_error(struct Reader *r)
+{
+	if (!__atomic_load_n(&r->failed, __ATOMIC_ACQUIRE) || reader_peek(r))
+		return 0;
+	return r->error ? r->error : EIO;
+}
+
+void reader_drain(struct Reader *r)
+{
+	char buf[64];
+	int n;
+	do {
+		SYSCALL(n = read(r->wake[0], buf, sizeof(buf)));
+	} while (n == sizeof(buf));
+}
+
+static int open_pipe(int fds[2])
+{
+	int i;
+	if (pipe(fds))
+		return -1;
+	for (i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
+
+/* Queue the output of the last packet. If the main thread is a whole
+ * ring behind, wait for it. Returns 0 if the reader is told to stop
+ * meanwhile.
+ */
+static int push_frame(struct Reader *r, int passthrough, ustime_t evtime)
+{
+	struct MTouch *mt = r->mt;
+	struct ReaderFrame *f;
+	char c = 0;
+	while (!(f = ring_next_free(&r->ring))) {
+		usleep(1000);
+		if (__atomic_load_n(&r->stopping, __ATOMIC_ACQUIRE))
+			return 0;
+	}
+	f->evtime = evtime;
+	f->passthrough = passthrough;
+	if (passthrough)
+		slotframe_extract(&f->slots, &mt->hs);
+	else
+		f->gs = mt->gs;
+	mtouch_take_warnings(mt, &f->warn);
+	f->ready = mtouch_time(mt);
+	ring_push(&r->ring);
+	/* a full pipe is as good as a new byte */
+	SYSCALL(write(r->wake[1], &c, 1));
+	return 1;
+}
+
+/* Process packets as they arrive and deadlines as they pass. The
+ * MTouch state belongs to this thread until it stops; only the config
+ * is shared, and handed over through mtouch_publish_config.
+ */
+static void *reader_main(void *arg)
+{
+	struct Reader *r = arg;
+	struct MTouch *mt = r->mt;
+	struct epoll_event ev;
+	int n, ret;
+	char c = 0;
+	for (;;) {
+		SYSCALL(n = epoll_wait(r->epfd, &ev, 1, mtouch_timeout(mt)));
+		if (n < 0)
+			break;
+		if (n > 0 && ev.data.fd == r->quit[0])
+			return NULL;
+		if (mtouch_update_mode(mt) && mt->passthrough &&
+		    !push_frame(r, 0, 0))
+			return NULL;
+		while ((ret = read_packet(mt, r->fd)) > 0) {
+			if (!push_frame(r, mt->passthrough, mt->hs.evtime))
+				return NULL;
+		}
+		if (ret < 0 && errno != EAGAIN)
+			break;
+		if (!mt->passthrough && read_timeouts(mt, r->fd) &&
+		    !push_frame(r, 0, 0))
+			return NULL;
+	}
+	/* the log is not safe from here, the main thread reports it */
+	r->error = errno;
+	__atomic_store_n(&r->failed, 1, __ATOMIC_RELEASE);
+	SYSCALL(write(r->wake[1], &c, 1));
+	return NULL;
+}
+
+int reader_start(struct MTouch *mt, int fd)
+{
+	struct Reader *r;
+	struct epoll_event ev;
+	sigset_t all, old;
+	int ret;
+
+	if (posix_memalign((void **)&r, 64, sizeof(*r)))
+		return -ENOMEM;
+	memset(r, 0, sizeof(*r));
+	r->mt = mt;
+	r->fd = fd;
+	r->epfd = -1;
+	r->wake[0] = r->wake[1] = -1;
+	r->quit[0] = r->quit[1] = -1;
+	if (open_pipe(r->wake) || open_pipe(r->quit))
+		goto error;
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd < 0)
+		goto error;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev))
+		goto error;
+	ev.data.fd = r->quit[0];
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->quit[0], &ev))
+		goto error;
+
+	/* signals, SIGIO above all, stay with the server's threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ret = pthread_create(&r->thread, NULL, reader_main, r);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret) {
+		errno = ret;
+		goto error;
+	}
+	mt->reader = r;
+	return r->wake[0];
+ error:
+	ret = -errno;
+	if (r->epfd >= 0)
+		close(r->epfd);
+	if (r->wake[0] >= 0) {
+		close(r->wake[0]);
+		close(r->wake[1]);
+	}
+	if (r->quit[0] >= 0) {
+		close(r->quit[0]);
+		close(r->quit[1]);
+	}
+	free(r);
+	return ret;
+}
+
+void reader_stop(struct MTouch *mt)
+{
+	struct Reader *r = mt->reader;
+	char c = 0;
+	if (!r)
+		return;
+	__atomic_store_n(&r->stopping, 1, __ATOMIC_RELEASE);
+	SYSCALL(write(r->quit[1], &c, 1));
+	pthread_join(r->thread, NULL);
+	close(r->epfd);
+	close(r->wake[0]);
+	close(r->wake[1]);
+	close(r->quit[0]);
+	close(r->quit[1]);
+	free(r);
+	mt->reader = NULL;
+}
@@ -22,20 +22,17 @@
 #include "trig.h"
 #include "common.h"
 
-/* Determine the angle of a vector within the given quadrant.
- * All this really does is calculate the slope in relation to
- * which quadrant it is in.
+/* Octant of a vector, indexed by the signs of dx and dy and by
+ * whether it is closer to the x axis than to the y axis. The angle
+ * is the octant base plus or minus the slope within the octant.
  */
-static double trig_quadrant_angle(int quadrant, double dx, double dy) {
-	dx = ABSVAL(dx);
-	dy = ABSVAL(dy);
-	if (quadrant == 1 || quadrant == 3)
-		return dx < dy ? 2-dx/dy : dy/dx;
-	else
-		return dy < dx ? 2-dy/dx : dx/dy;
-}
+static const int octant_base[8] = {
+	TR_ANGLE(0), TR_ANGLE(2), TR_ANGLE(4), TR_ANGLE(2),
+	TR_ANGLE(8), TR_ANGLE(6), TR_ANGLE(4), TR_ANGLE(6),
+};
+static const int octant_sign[8] = { 1, -1, -1, 1, -1, 1, 1, -1 };
 
-int trig_quadrant(double dx, double dy)
+int trig_quadrant(int dx, int dy)
 {
 	if (dx > 0 && dy < 0)
 		return 0;
@@ -49,49 +46,46 @@ int trig_quadrant(double dx, double dy)
 		return -1;
 }
 
-double trig_direction(double dx, double dy)
+int trig_direction(int dx, int dy)
 {
-	int qn;
+	int ax, ay, n, slope;
 	if (dx == 0 && dy == 0)
-		return TR_NONE;
-	else if (dx == 0)
-		return (dy < 0) ? 0 : 4;
-	else if (dy == 0)
-		return (dx > 0) ? 2 : 6;
-	else {
-		qn = trig_quadrant(dx, dy);
-		return qn*2 + trig_quadrant_angle(qn, dx, dy);
-	}
+		return TR_ANGLE_NONE;
+	ax = ABSVAL(clamp15(dx));
+	ay = ABSVAL(clamp15(dy));
+	n = (dx < 0) << 2 | (dy > 0) << 1 | (ay < ax);
+	if (ay < ax)
+		slope = (ay * TR_ANGLE(1) + ax / 2) / ax;
+	else
+		slope = (ax * TR_ANGLE(1) + ay / 2) / ay;
+	return (octant_base[n] + octant_sign[n] * slope) & TR_MASK;
 }
 
-int trig_generalize(double dir)
+int trig_generalize(int dir)
 {
-	if (dir == -1)
+	if (dir == TR_ANGLE_NONE)
 		return TR_NONE;
-	else if (dir > 1 && dir <= 3)
+	else if (dir > TR_ANGLE(1) && dir <= TR_ANGLE(3))
 		return TR_DIR_RT;
-	else if (dir > 3 && dir <= 5)
+	else if (dir > TR_ANGLE(3) && dir <= TR_ANGLE(5))
 		return TR_DIR_DN;
-	else if (dir > 5 && dir <= 7)
+	else if (dir > TR_ANGLE(5) && dir <= TR_ANGLE(7))
 		return TR_DIR_LT;
 	else
 		return TR_DIR_UP;
 }
 
-double trig_angles_add(double a1, double a2)
+int trig_angles_add(int a1, int a2)
 {
-	double a = MODVAL(a1 + a2, 8.0);
-	if (a < 0)
-		a = a + 8.0;
-	return a;
+	return (a1 + a2) & TR_MASK;
 }
 
-double trig_angles_sub(double a1, double a2)
+int trig_angles_sub(int a1, int a2)
 {
-	return trig_angles_add(a1, -1.0*a2);
+	return (a1 - a2) & TR_MASK;
 }
 
-double trig_angles_acute(double a1, double a2)
+int trig_angles_acute(int a1, int a2)
 {
 	if (a1 > a2)
 		return trig_angles_sub(a1, a2);
@@ -99,11 +93,11 @@ double trig_angles_acute(double a1, double a2)
 		return trig_angles_sub(a2, a1);
 }
 
-int trig_angles_cmp(double a1, double a2)
+int trig_angles_cmp(int a1, int a2)
 {
-	double m1, m2;
-	m1 = MODVAL(a1, 8);
-	m2 = MODVAL(a2, 8);
+	int m1, m2;
+	m1 = a1 % TR_TURN;
+	m2 = a2 % TR_TURN;
 	if (m1 == m2)
 		return 0;
 	else if (m1 > m2)
@@ -111,4 +105,3 @@ int trig_angles_cmp(double a1, double a2)
 	else
 		return -1;
 }
-
@@ -21,8 +21,30 @@
  **************************************************************************/
 
 #include "mtouch.h"
+#include "reader.h"
 #include <fcntl.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_PACKETS 1000
+#define BENCH_FRAMES 200000
+#define BENCH_ROUNDS 10
+
+static int use_mtdev = 0;
+static int use_bench = 0;
+static int use_latency = 0;
+static int use_reader = 0;
+static int bench_fingers = 0;
+
+/* Time from the event time of packets to some later point.
+ */
+struct Latency {
+	const char *name;
+	ustime_t total, max;
+	int count;
+};
 
 void xf86Msg(int type, const char *format, ...)
 {
@@ -50,56 +72,273 @@ double xf86SetRealOption(pointer opts, const char *name, double deflt)
 static void print_gestures(const struct Gestures* gs)
 {
 	int i;
-	static bitmask_t buttons_prev = 0U;
-	for (i = 0; i < 32; i++) {
-		if (GETBIT(gs->buttons, i) == GETBIT(buttons_prev, i))
-			continue;
-
-		if (GETBIT(gs->buttons, i))
-			printf("button %d down\n", i+1);
+	for (i = 0; i < gs->button_count; i++) {
+		if (gs->button_events[i].down)
+			printf("button %d down\n", gs->button_events[i].button+1);
 		else
-			printf("button %d up\n", i+1);
+			printf("button %d up\n", gs->button_events[i].button+1);
 	}
 
 	if (gs->move_dx != 0 || gs->move_dy != 0)
 		printf("moving (%+4d, %+4d)\n", gs->move_dx, gs->move_dy);
+	if (gs->scroll_dx != 0 || gs->scroll_dy != 0)
+		printf("scrolling (%+4d, %+4d)\n", gs->scroll_dx, gs->scroll_dy);
+
+	if (gs->gesture_ended != GS_GESTURE_NONE)
+		printf("gesture %d end\n", gs->gesture_ended);
+	if (gs->gesture_type != GS_GESTURE_NONE)
+		printf("gesture %d %s, %d touches (%+.1f, %+.1f) scale %.3f angle %+.2f\n",
+			gs->gesture_type, gs->gesture_begin ? "begin" : "update",
+			gs->gesture_fingers, gs->gesture_dx, gs->gesture_dy,
+			gs->gesture_scale, gs->gesture_angle);
+}
+
+static double elapsed_us(const struct timespec *t0, const struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e6 + (t1->tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+/* Time packet decoding alone, reading and parsing up to the end of a
+ * packet, without touch tracking or gestures. Run once with and once
+ * without -m to compare the direct slot parser against mtdev.
+ */
+static void bench_device(struct MTouch *mt, int fd)
+{
+	struct timespec t0, t1;
+	double total = 0;
+	int packets = 0;
+
+	printf("decoding through %s\n", mt->dev ? "mtdev" : "slot parser");
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (hwstate_modify(&mt->hs, mt->dev, fd, &mt->caps) <= 0) {
+			hwstate_idle(&mt->hs, mt->dev, fd, -1);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		total += elapsed_us(&t0, &t1);
+		if (++packets == BENCH_PACKETS) {
+			printf("%d packets, %.2f us per packet\n",
+				packets, total / packets);
+			total = 0;
+			packets = 0;
+		}
+	}
+}
+
+/* Fill in a frame of fingers moving together over a pad of the given
+ * capabilities, as the packet decoding would.
+ */
+static void synth_frame(struct HWState *hs, int fingers, int frame)
+{
+	int i;
+	/* BITONES would shift by the full width for every finger */
+	hs->used = fingers < DIM_FINGER ? BITONES(fingers) : ~(bitmask_t)0;
+	hs->changed_slots = hs->used;
+	hs->moved_slots = hs->used;
+	hs->changed_fields = BITMASK(HW_POSITION);
+	hs->evtime = (ustime_t)frame * 8000;
+	for (i = 0; i < fingers; i++) {
+		hs->data[i].tracking_id = i + 1;
+		hs->data[i].pressure = 128;
+		hs->position_x[i] = 100 * i + 4 * (frame & 255);
+		hs->position_y[i] = 50 * i + 2 * (frame & 255);
+	}
+}
+
+static double bench_round(struct MTouch *mt, int fingers, int gestures)
+{
+	struct timespec t0, t1;
+	int frame;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (frame = 1; frame <= BENCH_FRAMES; frame++) {
+		synth_frame(&mt->hs, fingers, frame);
+		mtstate_extract(&mt->state, &mt->cfg, &mt->hs);
+		if (gestures)
+			gestures_extract(&mt->gs, &mt->cfg, &mt->hs, &mt->state);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return elapsed_us(&t0, &t1) * 1e3 / BENCH_FRAMES;
+}
+
+/* Time touch tracking, and touch tracking with gestures, on synthetic
+ * frames of a number of fingers, without a device. The best round is
+ * the one to compare between builds, for instance of different
+ * MT_BITMASK_BITS.
+ */
+static void bench_synthetic(int fingers)
+{
+	static struct MTouch mt;
+	double track, both, best_track = 0, best_both = 0;
+	int i;
+
+	mt.caps.has_slot = 1;
+	mt.caps.slot.maximum = DIM_FINGER - 1;
+	mt.caps.has_abs[MTDEV_POSITION_X] = 1;
+	mt.caps.abs[MTDEV_POSITION_X].maximum = 4000;
+	mt.caps.has_abs[MTDEV_POSITION_Y] = 1;
+	mt.caps.abs[MTDEV_POSITION_Y].maximum = 3000;
+	mt.caps.has_abs[MTDEV_PRESSURE] = 1;
+	mt.caps.abs[MTDEV_PRESSURE].maximum = 255;
+	mconfig_defaults(&mt.cfg);
+	mconfig_init(&mt.cfg, &mt.caps);
+	hwstate_init(&mt.hs, &mt.caps);
+	mtstate_init(&mt.state, &mt.cfg);
+	gestures_init(&mt.gs);
+
+	printf("%d fingers, %d slots, %d frames per round\n",
+		fingers, DIM_FINGER, BENCH_FRAMES);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		track = bench_round(&mt, fingers, 0);
+		both = bench_round(&mt, fingers, 1);
+		printf("tracking %.1f ns, with gestures %.1f ns per frame\n",
+			track, both);
+		if (!i || track < best_track)
+			best_track = track;
+		if (!i || both < best_both)
+			best_both = both;
+	}
+	printf("best: tracking %.1f ns, with gestures %.1f ns per frame\n",
+		best_track, best_both);
+}
+
+static void latency_add(struct Latency *l, ustime_t evtime, ustime_t now)
+{
+	ustime_t us = now > evtime ? now - evtime : 0;
+	l->total += us;
+	if (us > l->max)
+		l->max = us;
+	if (++l->count == BENCH_PACKETS) {
+		printf("%s: %d packets, %.1f us average, %llu us max\n",
+			l->name, l->count, (double)l->total / l->count,
+			(unsigned long long)l->max);
+		l->total = 0;
+		l->max = 0;
+		l->count = 0;
+	}
+}
+
+/* Process packets on this thread. With -l, time how long each one
+ * takes from its event time to its gestures.
+ */
+static void run_direct(struct MTouch *mt, int fd)
+{
+	struct Latency out = { "direct" };
+	struct MWarnings warn;
+	while (1) {
+		while (read_packet(mt, fd) > 0) {
+			if (use_latency)
+				latency_add(&out, mt->hs.evtime, mtouch_time(mt));
+			else
+				print_gestures(&mt->gs);
+		}
+		mtouch_take_warnings(mt, &warn);
+		mtouch_log_warnings(&warn);
+		if (hwstate_idle(&mt->hs, mt->dev, fd, mtouch_timeout(mt)) &&
+		    read_timeouts(mt, fd) && !use_latency)
+			print_gestures(&mt->gs);
+	}
+}
+
+/* Process packets on a reader thread and take the frames it queues, as
+ * the driver does. With -l, time how long each packet takes to be
+ * processed and to be taken off the queue.
+ */
+static void run_reader(struct MTouch *mt, int fd)
+{
+	struct Latency ready = { "reader ready" };
+	struct Latency out = { "reader taken" };
+	const struct ReaderFrame *f;
+	struct pollfd wake;
+	ustime_t now;
 
-	buttons_prev = gs->buttons;
+	wake.fd = reader_start(mt, fd);
+	wake.events = POLLIN;
+	if (wake.fd < 0) {
+		fprintf(stderr, "error: could not start reader thread\n");
+		return;
+	}
+	while (poll(&wake, 1, -1) >= 0) {
+		reader_drain(mt->reader);
+		now = mtouch_time(mt);
+		while ((f = reader_peek(mt->reader))) {
+			mtouch_log_warnings(&f->warn);
+			if (!use_latency)
+				print_gestures(&f->gs);
+			else if (f->evtime) {
+				latency_add(&ready, f->evtime, f->ready);
+				latency_add(&out, f->evtime, now);
+			}
+			reader_pop(mt->reader);
+		}
+		if (reader_error(mt->reader)) {
+			fprintf(stderr, "error: reader thread stopped, error %d\n",
+				reader_error(mt->reader));
+			break;
+		}
+	}
+	reader_stop(mt);
 }
 
 static void loop_device(int fd)
 {
 	struct MTouch mt;
+	mconfig_defaults(&mt.cfg);
 	if (mtouch_configure(&mt, fd)) {
 		fprintf(stderr, "error: could not configure device\n");
 		return;
 	}
+	if (use_mtdev)
+		mt.caps.has_slot = 0;
 	if (mtouch_open(&mt, fd)) {
 		fprintf(stderr, "error: could not open device\n");
 		return;
 	}
-	
-	mconfig_defaults(&mt.cfg);
+
 	printf("width:  %d\n", mt.hs.max_x);
 	printf("height: %d\n", mt.hs.max_y);
 
-	//while (!mtdev_idle(&mt.dev, fd, 5000)) {
-	while (1) {
-		while (read_packet(&mt, fd) > 0)
-			print_gestures(&mt.gs);
-		if (has_delayed(&mt, fd))
-			print_gestures(&mt.gs);
-	}
+	if (use_bench)
+		bench_device(&mt, fd);
+
+	if (use_reader)
+		run_reader(&mt, fd);
+	else
+		run_direct(&mt, fd);
 	mtouch_close(&mt, fd);
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc < 2) {
-		fprintf(stderr, "Usage: test <mtdev>\n");
-		return -1;
+	int opt;
+	while ((opt = getopt(argc, argv, "blms:t")) != -1) {
+		switch (opt) {
+		case 'b':
+			use_bench = 1;
+			break;
+		case 'l':
+			use_latency = 1;
+			break;
+		case 'm':
+			use_mtdev = 1;
+			break;
+		case 's':
+			bench_fingers = atoi(optarg);
+			break;
+		case 't':
+			use_reader = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (bench_fingers > 0 && bench_fingers <= DIM_FINGER) {
+		bench_synthetic(bench_fingers);
+		return 0;
 	}
-	int fd = open(argv[1], O_RDONLY | O_NONBLOCK);
+	if (bench_fingers || optind >= argc)
+		goto usage;
+	int fd = open(argv[optind], O_RDONLY | O_NONBLOCK);
 	if (fd < 0) {
 		fprintf(stderr, "error: could not open file\n");
 		return -1;
@@ -107,4 +346,13 @@ int main(int argc, char *argv[])
 	loop_device(fd);
 	close(fd);
 	return 0;
+ usage:
+	fprintf(stderr, "Usage: test [-b] [-l] [-m] [-t] <mtdev>\n");
+	fprintf(stderr, "       test -s <fingers>\n");
+	fprintf(stderr, "  -b  benchmark packet decoding\n");
+	fprintf(stderr, "  -l  measure latency from event time to gestures\n");
+	fprintf(stderr, "  -m  decode through mtdev even if the device has slots\n");
+	fprintf(stderr, "  -s  benchmark touch tracking on synthetic frames\n");
+	fprintf(stderr, "  -t  process packets on a reader thread\n");
+	return -1;
 }
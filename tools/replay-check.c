@@ -0,0 +1,326 @@
+/***************************************************************************
+ *
+ * Multitouch X driver
+ * Copyright (C) 2008 Henrik Rydberg <rydberg@euromail.se>
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+/* Replay the same input through several devices at once, one thread
+ * each, and compare what each one makes of it with a replay of that
+ * input alone. Every other device gets the input without its physical
+ * clicks, so state shared between devices shows up as a difference.
+ *
+ * The input is a synthetic session of taps, moves, clicks, scrolls,
+ * swipes and pinches, or the raw events of a file, as read from an
+ * event device node. Both are replayed on a pad of fixed capabilities.
+ */
+
+#include "mtouch.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define REPLAY_THREADS 6
+#define REPLAY_ROUNDS 4
+#define REPLAY_OUTPUT (1 << 20)
+
+/* Deadlines a packet may have passed, more than gestures set. */
+#define MAX_EXPIRES 8
+
+struct Trace {
+	struct input_event *ev;
+	int count, size;
+};
+
+/* One device replaying a trace, and what it made of it. */
+struct Replay {
+	struct MTouch mt;
+	const struct Trace *trace;
+	int yield;
+	char *out;
+	size_t len;
+};
+
+void xf86Msg(int type, const char *format, ...)
+{
+}
+
+int xf86SetIntOption(pointer opts, const char *name, int deflt)
+{
+	return deflt;
+}
+
+int xf86SetBoolOption(pointer opts, const char *name, int deflt)
+{
+	return deflt;
+}
+
+double xf86SetRealOption(pointer opts, const char *name, double deflt)
+{
+	return deflt;
+}
+
+static void trace_add(struct Trace *t, ustime_t time, int type, int code, int value)
+{
+	struct input_event *ev;
+	if (t->count == t->size) {
+		t->size = t->size ? 2 * t->size : 4096;
+		t->ev = realloc(t->ev, t->size * sizeof(*t->ev));
+		if (!t->ev) {
+			fprintf(stderr, "error: out of memory\n");
+			exit(1);
+		}
+	}
+	ev = &t->ev[t->count++];
+	ev->time.tv_sec = time / 1000000;
+	ev->time.tv_usec = time % 1000000;
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+/* Frames of fingers moving in a straight line from (x, y) by (dx, dy)
+ * per frame, spread apart by (sx, sy) per finger and more so by
+ * (gx, gy) per frame. Clicks the button for the middle of them if
+ * asked to. Returns the time after the last frame.
+ */
+static ustime_t synth_stroke(struct Trace *t, ustime_t time, int *id, int fingers,
+			     int frames, int x, int y, int dx, int dy,
+			     int sx, int sy, int gx, int gy, int click)
+{
+	int f, i, first = *id;
+	for (f = 0; f <= frames; f++, time += 8000) {
+		for (i = 0; i < fingers; i++) {
+			trace_add(t, time, EV_ABS, ABS_MT_SLOT, i);
+			if (f == 0) {
+				trace_add(t, time, EV_ABS, ABS_MT_TRACKING_ID, first + i);
+				trace_add(t, time, EV_ABS, ABS_MT_TOUCH_MAJOR, 150);
+				trace_add(t, time, EV_ABS, ABS_MT_TOUCH_MINOR, 140);
+				trace_add(t, time, EV_ABS, ABS_MT_WIDTH_MAJOR, 300);
+				trace_add(t, time, EV_ABS, ABS_MT_PRESSURE, 100);
+			}
+			else if (f == frames) {
+				trace_add(t, time, EV_ABS, ABS_MT_TRACKING_ID, -1);
+				continue;
+			}
+			trace_add(t, time, EV_ABS, ABS_MT_POSITION_X,
+				  x + f * dx + i * (sx + f * gx));
+			trace_add(t, time, EV_ABS, ABS_MT_POSITION_Y,
+				  y + f * dy + i * (sy + f * gy));
+		}
+		if (click && f == frames / 3)
+			trace_add(t, time, EV_KEY, BTN_LEFT, 1);
+		if (click && f == 2 * frames / 3)
+			trace_add(t, time, EV_KEY, BTN_LEFT, 0);
+		trace_add(t, time, EV_SYN, SYN_REPORT, 0);
+	}
+	*id += fingers;
+	return time;
+}
+
+static void synth_session(struct Trace *t)
+{
+	ustime_t time = 1000000;
+	int id = 1, r;
+	for (r = 0; r < 4; r++) {
+		int o = 150 * r;
+		/* taps of one, two and three fingers */
+		time = synth_stroke(t, time, &id, 1, 4, -1000 + o, 2000, 0, 0, 0, 0, 0, 0, 0) + 400000;
+		time = synth_stroke(t, time, &id, 2, 4, -1000 + o, 2000, 0, 0, 900, 0, 0, 0, 0) + 400000;
+		time = synth_stroke(t, time, &id, 3, 4, -1000 + o, 2000, 0, 0, 900, 0, 0, 0, 0) + 400000;
+		/* tap and drag */
+		time = synth_stroke(t, time, &id, 1, 4, o, 3000, 0, 0, 0, 0, 0, 0, 0) + 60000;
+		time = synth_stroke(t, time, &id, 1, 60, o, 3000, 30, -10, 0, 0, 0, 0, 0) + 400000;
+		/* moves, with and without a click */
+		time = synth_stroke(t, time, &id, 1, 40, -2000 + o, 1000, 25, 40, 0, 0, 0, 0, 0) + 200000;
+		time = synth_stroke(t, time, &id, 1, 30, 1000 - o, 5000, -5, 3, 0, 0, 0, 0, 1) + 200000;
+		time = synth_stroke(t, time, &id, 2, 30, 0, 5500, 0, 0, 1000, 0, 0, 0, 1) + 200000;
+		/* two finger scrolls, three and four finger swipes */
+		time = synth_stroke(t, time, &id, 2, 50, -500, 1000 + o, 0, 60, 900, 0, 0, 0, 0) + 300000;
+		time = synth_stroke(t, time, &id, 2, 50, -2500, 3000, 60, 0, 0, 900, 0, 0, 0) + 300000;
+		time = synth_stroke(t, time, &id, 3, 50, -2000, 1000 + o, 80, 0, 900, 0, 0, 0, 0) + 300000;
+		time = synth_stroke(t, time, &id, 4, 50, -2500, 5000 - o, 0, -80, 900, 0, 0, 0, 0) + 300000;
+		/* pinches in and out */
+		time = synth_stroke(t, time, &id, 2, 50, -200, 3000, -20, 0, 400, 0, 40, 0, 0) + 300000;
+		time = synth_stroke(t, time, &id, 2, 50, -1500, 3000, 20, 0, 3000, 0, -40, 0, 0) + 300000;
+	}
+}
+
+/* The trace without its physical clicks. */
+static void strip_clicks(struct Trace *t, const struct Trace *from)
+{
+	int i;
+	for (i = 0; i < from->count; i++) {
+		const struct input_event *ev = &from->ev[i];
+		if (ev->type != EV_KEY)
+			trace_add(t, ev->time.tv_sec * 1000000ULL + ev->time.tv_usec,
+				  ev->type, ev->code, ev->value);
+	}
+}
+
+static int read_trace(struct Trace *t, const char *path)
+{
+	struct input_event ev;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return -1;
+	while (fread(&ev, sizeof(ev), 1, f) == 1)
+		trace_add(t, ev.time.tv_sec * 1000000ULL + ev.time.tv_usec,
+			  ev.type, ev.code, ev.value);
+	fclose(f);
+	return 0;
+}
+
+static void set_abs(struct Capabilities *caps, int i, int min, int max)
+{
+	caps->has_abs[i] = 1;
+	caps->abs[i].minimum = min;
+	caps->abs[i].maximum = max;
+}
+
+static void output(struct Replay *rp, ustime_t time)
+{
+	const struct Gestures *gs = &rp->mt.gs;
+	char *s = rp->out + rp->len;
+	int i;
+	if (rp->len > REPLAY_OUTPUT - 1024)
+		return;
+	for (i = 0; i < gs->button_count; i++)
+		s += sprintf(s, "%llu button %d %s\n", (unsigned long long)time,
+			     gs->button_events[i].button + 1,
+			     gs->button_events[i].down ? "down" : "up");
+	if (gs->move_dx || gs->move_dy)
+		s += sprintf(s, "%llu move %d %d\n", (unsigned long long)time,
+			     gs->move_dx, gs->move_dy);
+	if (gs->scroll_dx || gs->scroll_dy)
+		s += sprintf(s, "%llu scroll %d %d\n", (unsigned long long)time,
+			     gs->scroll_dx, gs->scroll_dy);
+	if (gs->gesture_type != GS_GESTURE_NONE)
+		s += sprintf(s, "%llu gesture %d %d\n", (unsigned long long)time,
+			     gs->gesture_type, gs->gesture_fingers);
+	rp->len = s - rp->out;
+}
+
+/* Feed the trace a packet at a time through a pipe, running the
+ * gesture deadlines the packets pass as the timer would.
+ */
+static void *replay(void *arg)
+{
+	struct Replay *rp = arg;
+	struct MTouch *mt = &rp->mt;
+	const struct Trace *t = rp->trace;
+	struct Capabilities *caps = &mt->caps;
+	ustime_t time, deadline;
+	int p[2], i, n, start = 0;
+
+	rp->len = 0;
+	if (pipe(p))
+		return NULL;
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	memset(mt, 0, sizeof(*mt));
+	caps->has_left = 1;
+	caps->has_slot = 1;
+	caps->slot.maximum = 15;
+	set_abs(caps, MTDEV_TOUCH_MAJOR, 0, 1000);
+	set_abs(caps, MTDEV_TOUCH_MINOR, 0, 1000);
+	set_abs(caps, MTDEV_WIDTH_MAJOR, 0, 1000);
+	set_abs(caps, MTDEV_POSITION_X, -4000, 4000);
+	set_abs(caps, MTDEV_POSITION_Y, -200, 7000);
+	set_abs(caps, MTDEV_TRACKING_ID, 0, 65535);
+	set_abs(caps, MTDEV_PRESSURE, 0, 255);
+	mconfig_defaults(&mt->cfg);
+	mtouch_open(mt, p[0]);
+
+	for (i = 0; i < t->count; i++) {
+		if (t->ev[i].type != EV_SYN || t->ev[i].code != SYN_REPORT)
+			continue;
+		time = t->ev[i].time.tv_sec * 1000000ULL + t->ev[i].time.tv_usec;
+		for (n = 0; n < MAX_EXPIRES; n++) {
+			deadline = gestures_deadline(&mt->gs);
+			if (!deadline || deadline > time)
+				break;
+			if (gestures_expire(&mt->gs, &mt->state, deadline))
+				output(rp, deadline);
+		}
+		if (write(p[1], &t->ev[start], (i + 1 - start) * sizeof(t->ev[0])) < 0)
+			break;
+		start = i + 1;
+		while (read_packet(mt, p[0]) > 0) {
+			output(rp, time);
+			if (rp->yield)
+				sched_yield();
+		}
+	}
+	mtouch_close(mt, p[0]);
+	close(p[0]);
+	close(p[1]);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct Replay ref[2], rp[REPLAY_THREADS];
+	struct Trace trace[2];
+	pthread_t thread[REPLAY_THREADS];
+	int i, round, failed = 0;
+
+	memset(trace, 0, sizeof(trace));
+	if (argc > 1) {
+		if (read_trace(&trace[0], argv[1])) {
+			fprintf(stderr, "error: could not read %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+		synth_session(&trace[0]);
+	strip_clicks(&trace[1], &trace[0]);
+
+	for (i = 0; i < 2; i++) {
+		ref[i].trace = &trace[i];
+		ref[i].out = malloc(REPLAY_OUTPUT);
+		replay(&ref[i]);
+	}
+	for (i = 0; i < REPLAY_THREADS; i++) {
+		rp[i].trace = &trace[i % 2];
+		rp[i].yield = i / 2 % 2;
+		rp[i].out = malloc(REPLAY_OUTPUT);
+	}
+	printf("%d events, %zu and %zu bytes of output with and without clicks\n",
+	       trace[0].count, ref[0].len, ref[1].len);
+
+	for (round = 0; round < REPLAY_ROUNDS; round++) {
+		for (i = 0; i < REPLAY_THREADS; i++)
+			pthread_create(&thread[i], NULL, replay, &rp[i]);
+		for (i = 0; i < REPLAY_THREADS; i++)
+			pthread_join(thread[i], NULL);
+		for (i = 0; i < REPLAY_THREADS; i++) {
+			const struct Replay *r = &ref[i % 2];
+			if (rp[i].len != r->len || memcmp(rp[i].out, r->out, r->len)) {
+				printf("round %d: device %d differs from its replay alone\n",
+				       round, i);
+				failed = 1;
+			}
+		}
+	}
+	if (!failed)
+		printf("%d devices on %d threads match their replays alone\n",
+		       REPLAY_THREADS, REPLAY_THREADS);
+	return failed;
+}
@@ -0,0 +1,201 @@
+/***************************************************************************
+ *
+ * Multitouch X driver
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+/* Compare the fixed point angles of trig.c against the floating point
+ * functions they replaced, kept here as the reference. Fails if any
+ * direction is off by more than one step of the fixed point angle or
+ * if any generalized direction or acute angle test disagrees, then
+ * prints the time each version takes.
+ */
+
+#include "trig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK_RANGE 128
+#define CHECK_VECTORS 4096
+#define CHECK_ROUNDS 2000
+
+/* Reference angles count 45 degree steps, 0 <= a < 8. */
+
+static int ref_quadrant(double dx, double dy)
+{
+	if (dx > 0 && dy < 0)
+		return 0;
+	else if (dx > 0 && dy > 0)
+		return 1;
+	else if (dx < 0 && dy > 0)
+		return 2;
+	else if (dx < 0 && dy < 0)
+		return 3;
+	else
+		return -1;
+}
+
+static double ref_quadrant_angle(int quadrant, double dx, double dy)
+{
+	dx = dx < 0 ? -dx : dx;
+	dy = dy < 0 ? -dy : dy;
+	if (quadrant == 1 || quadrant == 3)
+		return dx < dy ? 2-dx/dy : dy/dx;
+	else
+		return dy < dx ? 2-dy/dx : dx/dy;
+}
+
+static double ref_direction(double dx, double dy)
+{
+	int qn;
+	if (dx == 0 && dy == 0)
+		return TR_NONE;
+	else if (dx == 0)
+		return (dy < 0) ? 0 : 4;
+	else if (dy == 0)
+		return (dx > 0) ? 2 : 6;
+	else {
+		qn = ref_quadrant(dx, dy);
+		return qn*2 + ref_quadrant_angle(qn, dx, dy);
+	}
+}
+
+static int ref_generalize(double dir)
+{
+	if (dir == -1)
+		return TR_NONE;
+	else if (dir > 1 && dir <= 3)
+		return TR_DIR_RT;
+	else if (dir > 3 && dir <= 5)
+		return TR_DIR_DN;
+	else if (dir > 5 && dir <= 7)
+		return TR_DIR_LT;
+	else
+		return TR_DIR_UP;
+}
+
+static double ref_angles_add(double a1, double a2)
+{
+	double a = a1 + a2 - (int)((a1 + a2) / 8.0) * 8.0;
+	if (a < 0)
+		a = a + 8.0;
+	return a;
+}
+
+static double ref_angles_acute(double a1, double a2)
+{
+	if (a1 > a2)
+		return ref_angles_add(a1, -a2);
+	else
+		return ref_angles_add(a2, -a1);
+}
+
+/* Distance in fixed point steps between an angle and a reference
+ * angle, around the circle.
+ */
+static int angle_error(int a, double ref)
+{
+	int e = abs(a - (int)(ref * TR_ANGLE(1) + 0.5));
+	return e > TR_TURN / 2 ? TR_TURN - e : e;
+}
+
+static double now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int main(void)
+{
+	static int vx[CHECK_VECTORS], vy[CHECK_VECTORS], na[CHECK_VECTORS];
+	static double ra[CHECK_VECTORS];
+	int dx, dy, i, r, e, worst = 0, generalize = 0, acute = 0, add = 0;
+	double t0, ref_sum = 0;
+	long sum = 0;
+
+	/* Every vector of a window around the origin. */
+	for (dx = -CHECK_RANGE; dx <= CHECK_RANGE; dx++) {
+		for (dy = -CHECK_RANGE; dy <= CHECK_RANGE; dy++) {
+			double ref = ref_direction(dx, dy);
+			int a = trig_direction(dx, dy);
+			if (ref == TR_NONE)
+				e = a != TR_ANGLE_NONE;
+			else
+				e = angle_error(a, ref);
+			if (e > worst)
+				worst = e;
+			if (ref_generalize(ref) != trig_generalize(a))
+				generalize++;
+		}
+	}
+
+	/* Pairs of random movements, some of them none, as gestures
+	 * compare them.
+	 */
+	srand(1);
+	for (i = 0; i < CHECK_VECTORS; i++) {
+		vx[i] = i % 16 ? rand() % 601 - 300 : 0;
+		vy[i] = i % 16 ? rand() % 601 - 300 : 0;
+		ra[i] = ref_direction(vx[i], vy[i]);
+		na[i] = trig_direction(vx[i], vy[i]);
+	}
+	for (i = 0; i + 1 < CHECK_VECTORS; i++) {
+		if ((ref_angles_acute(ra[i], ra[i+1]) < 2) !=
+		    (trig_angles_acute(na[i], na[i+1]) < TR_ANGLE(2)))
+			acute++;
+		if (ra[i] != TR_NONE &&
+		    angle_error(trig_angles_add(na[i], TR_ANGLE(2)), ref_angles_add(ra[i], 2)) > 1)
+			add++;
+	}
+
+	printf("direction: worst error %d of %d per 45 degrees\n", worst, TR_ANGLE(1));
+	printf("generalize: %d of %d directions differ\n", generalize,
+		(2 * CHECK_RANGE + 1) * (2 * CHECK_RANGE + 1));
+	printf("acute below 90 degrees: %d of %d pairs differ\n", acute, CHECK_VECTORS - 1);
+	printf("add 90 degrees: %d of %d angles differ\n", add, CHECK_VECTORS);
+
+	t0 = now_ns();
+	for (r = 0; r < CHECK_ROUNDS; r++)
+		for (i = 0; i < CHECK_VECTORS; i++)
+			ref_sum += ref_direction(vx[i], vy[i] + r);
+	printf("direction: reference %.2f ns", (now_ns() - t0) / ((double)CHECK_ROUNDS * CHECK_VECTORS));
+	t0 = now_ns();
+	for (r = 0; r < CHECK_ROUNDS; r++)
+		for (i = 0; i < CHECK_VECTORS; i++)
+			sum += trig_direction(vx[i], vy[i] + r);
+	printf(", fixed point %.2f ns\n", (now_ns() - t0) / ((double)CHECK_ROUNDS * CHECK_VECTORS));
+
+	t0 = now_ns();
+	for (r = 0; r < CHECK_ROUNDS; r++)
+		for (i = 0; i + 1 < CHECK_VECTORS; i++)
+			ref_sum += ref_angles_acute(ra[i], ra[i+1] + r * 1e-9);
+	printf("acute: reference %.2f ns", (now_ns() - t0) / ((double)CHECK_ROUNDS * CHECK_VECTORS));
+	t0 = now_ns();
+	for (r = 0; r < CHECK_ROUNDS; r++)
+		for (i = 0; i + 1 < CHECK_VECTORS; i++)
+			sum += trig_angles_acute(na[i], na[i+1] + r);
+	printf(", fixed point %.2f ns\n", (now_ns() - t0) / ((double)CHECK_ROUNDS * CHECK_VECTORS));
+
+	/* Keep the timed loops from being optimized away. */
+	if (ref_sum == 0.5 && sum == 1)
+		printf("\n");
+
+	return worst > 1 || generalize || acute || add;
+}